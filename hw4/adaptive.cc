@@ -0,0 +1,131 @@
+/*
+ * AdaptiveTree: FGK-style in-place Huffman tree updates.
+ */
+
+#include <stdexcept>
+#include <utility>
+
+#include "adaptive.hh"
+
+namespace huffman {
+
+    AdaptiveTree::AdaptiveTree(value_t num_values)
+        : nodes_(2 * num_values + 1), leaves_(num_values, NONE)
+    {
+        /* New nodes are numbered downwards from the root, so the NYT leaf
+         * is always the lowest-numbered (and lightest) node in the tree. */
+        nyt_ = root();
+        /* Every block has a leader, so there are never more blocks than
+         * nodes. */
+        leaders_.reserve(nodes_.size());
+        free_blocks_.reserve(nodes_.size());
+        nodes_[nyt_] = { 0, NONE, { NONE, NONE }, num_values, newBlock(nyt_) };
+    }
+
+    size_t AdaptiveTree::memoryUsage() const {
+        return nodes_.capacity() * sizeof(Node) +
+            (leaves_.capacity() + leaders_.capacity() + free_blocks_.capacity()) * sizeof(int);
+    }
+
+    int AdaptiveTree::leaf(value_t value) const {
+        if (value >= leaves_.size()) {
+            throw std::runtime_error("value out of range!");
+        }
+        return leaves_[value] == NONE ? nyt_ : leaves_[value];
+    }
+
+    int AdaptiveTree::newBlock(int leader) {
+        if (free_blocks_.empty()) {
+            leaders_.push_back(leader);
+            return static_cast<int>(leaders_.size()) - 1;
+        }
+        int block = free_blocks_.back();
+        free_blocks_.pop_back();
+        leaders_[block] = leader;
+        return block;
+    }
+
+    void AdaptiveTree::swap(int a, int b) {
+        /* Exchange the subtrees numbered a and b. Both have the same weight,
+         * so the numbering stays sorted, and the parent links and blocks
+         * belong to the positions, so they stay put. */
+        Node& x = nodes_[a];
+        Node& y = nodes_[b];
+        std::swap(x.child, y.child);
+        std::swap(x.value, y.value);
+        for (int pos : { a, b }) {
+            if (isLeaf(pos)) {
+                leaves_[nodes_[pos].value] = pos;  // Never the NYT leaf
+            } else {
+                nodes_[child(pos, false)].parent = pos;
+                nodes_[child(pos, true)].parent = pos;
+            }
+        }
+    }
+
+    void AdaptiveTree::bump(int node) {
+        /* Increment the weight of node, which must be the leader of its
+         * block: it moves from the top of block w to the bottom of w+1. */
+        Node& n = nodes_[node];
+        const int block = n.block;
+        if (node > nyt_ && nodes_[node - 1].block == block) {
+            leaders_[block] = node - 1;
+        } else {
+            free_blocks_.push_back(block);
+        }
+
+        n.weight++;
+        if (node < root() && nodes_[node + 1].weight == n.weight) {
+            n.block = nodes_[node + 1].block;
+        } else {
+            n.block = newBlock(node);
+        }
+    }
+
+    void AdaptiveTree::update(value_t value) {
+        int q = leaf(value);
+
+        if (q == nyt_) {
+            /* First occurrence: the NYT leaf becomes an internal node with
+             * a new NYT leaf and a leaf for value as its children. */
+            const int block = nodes_[q].block;
+            nodes_[q].child[0] = q - 2;
+            nodes_[q].child[1] = q - 1;
+            nodes_[q - 1] = { 0, q, { NONE, NONE }, value, block };
+            nodes_[q - 2] = { 0, q, { NONE, NONE }, nodes_[q].value, block };
+            leaves_[value] = q - 1;
+            nyt_ = q - 2;
+            q = q - 1;
+        }
+
+        while (q != NONE) {
+            const int leader = leaders_[nodes_[q].block];
+            const int up = parent(q);
+
+            if (leader == up) {
+                /* Only happens when q's sibling is the NYT leaf, so q and its
+                 * parent weigh the same. The parent can't be swapped with its
+                 * own descendant: swap with the highest node below it first. */
+                if (leader - 1 != q) {
+                    swap(q, leader - 1);
+                    q = leader - 1;
+                    continue;
+                }
+                /* q and its parent are the last two nodes of their weight:
+                 * bumping the parent first keeps both bumps legal. */
+                bump(leader);
+                bump(q);
+                q = parent(leader);
+                continue;
+            }
+
+            if (leader != q) {
+                swap(q, leader);
+                q = leader;
+            }
+            bump(q);
+            q = parent(q);
+        }
+    }
+
+} // namespace huffman
@@ -0,0 +1,77 @@
+/*
+ * adaptive.hh: a mutable Huffman tree that is updated in place, one symbol
+ * at a time, with the FGK algorithm (Faller, Gallager and Knuth).
+ *
+ * Nodes live in a single array whose indices ("numbers") list them in
+ * non-decreasing weight order with siblings adjacent (the sibling property).
+ * Incrementing a symbol only touches the nodes on its path to the root, so
+ * an update costs O(code length) rather than a full rebuild.
+ *
+ * Values that were never seen hang off a single zero-weight NYT ("not yet
+ * transmitted") leaf. The tree only stores the values it has seen.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace huffman {
+
+class AdaptiveTree {
+  public:
+    using value_t = unsigned;
+    using weight_t = uint64_t;
+
+    // Position of "no node" (parent of the root, child of a leaf).
+    static constexpr int NONE = -1;
+
+    // Create a tree that can hold values 0..num_values-1. It starts out
+    // as a single NYT leaf.
+    explicit AdaptiveTree(value_t num_values);
+
+    // Increment the weight of value, adding it to the tree if necessary,
+    // and restore the sibling property.
+    void update(value_t value);
+
+    // Position of the leaf holding value, or of the NYT leaf if the value
+    // wasn't seen yet.
+    int leaf(value_t value) const;
+
+    // Is the given leaf the NYT leaf?
+    bool isNYT(int node) const { return node == nyt_; }
+
+    int root() const { return static_cast<int>(nodes_.size()) - 1; }
+    int parent(int node) const { return nodes_[node].parent; }
+    bool isLeaf(int node) const { return nodes_[node].child[0] == NONE; }
+    int child(int node, bool right) const { return nodes_[node].child[right]; }
+    // Is node the right child of its parent?
+    bool isRight(int node) const { return child(parent(node), true) == node; }
+    value_t value(int node) const { return nodes_[node].value; }
+    weight_t weight(int node) const { return nodes_[node].weight; }
+
+    // Heap memory held by the tree, in bytes. It's all allocated up front.
+    size_t memoryUsage() const;
+
+  private:
+    struct Node {
+        weight_t weight;
+        int parent;
+        int child[2];  // Both NONE for leaves
+        value_t value; // Only meaningful for leaves
+        int block;     // All positions with equal weight share a block
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<int> leaves_;  // Value -> leaf position (or NONE)
+    std::vector<int> leaders_; // Block -> highest position in the block
+    std::vector<int> free_blocks_;
+    int nyt_;                  // Position of the NYT leaf (always the lowest)
+
+    void swap(int a, int b);
+    void bump(int node);
+    int newBlock(int leader);
+};
+
+} // namespace
@@ -0,0 +1,153 @@
+/*
+ * ArrayTree: a tree implementation using a flat array of nodes
+ */
+
+#include <limits>
+#include <stdexcept>
+
+#include "arraytree.hh"
+
+namespace tree {
+
+    ArrayTree::ArrayTree(value_t value)
+        : nodes_{ { value, NONE, NONE } }
+    { }
+
+    ArrayTree::ArrayTree(value_t newroot, const ArrayTree& left, const ArrayTree& right) {
+        const auto total = 1 + left.nodes_.size() + right.nodes_.size();
+        if (total > std::numeric_limits<index_t>::max()) {
+            throw std::runtime_error("tree too large for 16-bit indices!");
+        }
+
+        /* Lay out the new root, then the left subtree, then the right one,
+         * shifting the copied child indices by each subtree's new offset. */
+        nodes_.reserve(total);
+        const index_t left_start = 1;
+        const index_t right_start = left_start + left.nodes_.size();
+        nodes_.push_back({ newroot, left_start, right_start });
+        for (const auto& subtree : { std::make_pair(&left, left_start),
+                                     std::make_pair(&right, right_start) }) {
+            for (auto node : subtree.first->nodes_) {
+                if (node.left != NONE) {
+                    node.left += subtree.second;
+                }
+                if (node.right != NONE) {
+                    node.right += subtree.second;
+                }
+                nodes_.push_back(node);
+            }
+        }
+    }
+
+    unsigned ArrayTree::size() const {
+        return nodes_.size();
+    }
+
+    std::string ArrayTree::pathTo(value_t value) const {
+        /* The first match in preorder is the same one a left-biased search
+         * would find. */
+        index_t target = 0;
+        while (target < nodes_.size() && nodes_[target].value != value) {
+            target++;
+        }
+        if (target == nodes_.size()) {
+            throw std::runtime_error("value not found in tree!");
+        }
+
+        /* In preorder, a node's right subtree starts right after its left
+         * subtree ends, so the target's index tells us which way to go. */
+        std::string path;
+        for (index_t node = 0; node != target; ) {
+            const auto& n = nodes_[node];
+            if (n.right != NONE && target >= n.right) {
+                path += 'R';
+                node = n.right;
+            } else {
+                path += 'L';
+                node = n.left;
+            }
+        }
+        return path;
+    }
+
+    ArrayTree::value_t ArrayTree::getByPath(const std::string& path) const {
+        index_t node = 0;
+        for (auto direction : path) {
+            if (direction == 'L') {
+                node = nodes_[node].left;
+            } else if (direction == 'R') {
+                node = nodes_[node].right;
+            } else {
+                throw std::runtime_error("invalid character in path!");
+            }
+            if (node == NONE) {
+                throw std::runtime_error("Value not in tree!");
+            }
+        }
+        return nodes_[node].value;
+    }
+
+    /* A cursor names a node by its index. */
+    uintptr_t ArrayTree::root() const {
+        return 0;
+    }
+
+    bool ArrayTree::child(uintptr_t& node, bool right) const {
+        const auto next = right ? nodes_[node].right : nodes_[node].left;
+        if (next == NONE) {
+            return false;
+        }
+        node = next;
+        return true;
+    }
+
+    ArrayTree::value_t ArrayTree::value(uintptr_t node) const {
+        return nodes_[node].value;
+    }
+
+    ArrayTreeBuilder::node_t ArrayTreeBuilder::add(const Node& node) {
+        if (nodes_.size() == NONE) {
+            throw std::runtime_error("tree too large for 16-bit indices!");
+        }
+        nodes_.push_back(node);
+        return node_t(nodes_.size() - 1);
+    }
+
+    ArrayTreeBuilder::node_t ArrayTreeBuilder::leaf(value_t value) {
+        return add({ value, NONE, NONE });
+    }
+
+    ArrayTreeBuilder::node_t ArrayTreeBuilder::join(value_t newroot, node_t left, node_t right) {
+        return add({ newroot, left, right });
+    }
+
+    void ArrayTreeBuilder::build(node_t root, ArrayTree& tree) {
+        /* Walk the tree depth first, left before right, so each node lands
+         * right after its parent (or its left sibling's subtree), and link
+         * it into its parent as it goes in. */
+        auto& out = tree.nodes_;
+        out.clear();
+        out.reserve(nodes_.size());
+        pending_.reserve(nodes_.size());
+        pending_.assign(1, { root, ArrayTree::NONE, false });
+        while (!pending_.empty()) {
+            const auto next = pending_.back();
+            pending_.pop_back();
+            const auto& node = nodes_[next.node];
+            const auto here = ArrayTree::index_t(out.size());
+            if (here != 0) {
+                auto& parent = out[next.parent];
+                (next.right ? parent.right : parent.left) = here;
+            }
+            out.push_back({ node.value, ArrayTree::NONE, ArrayTree::NONE });
+            if (node.right != NONE) {
+                pending_.push_back({ node.right, here, true });
+            }
+            if (node.left != NONE) {
+                pending_.push_back({ node.left, here, false });
+            }
+        }
+        nodes_.clear();
+    }
+
+} // namespace tree
@@ -0,0 +1,99 @@
+/*
+ * ArrayTree: a tree implementation that keeps all of its nodes in one
+ * contiguous array (in preorder), linked by 16-bit indices instead of
+ * pointers.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tree.hh"
+
+namespace tree {
+
+class ArrayTree : public Tree {
+  public:
+    ArrayTree(value_t value);
+    // Copies both children into the new tree's array. (To build a big tree
+    // from the bottom up, an ArrayTreeBuilder saves all that copying.)
+    ArrayTree(value_t newroot, const ArrayTree& left, const ArrayTree& right);
+
+    virtual unsigned size() const override;
+
+    virtual std::string pathTo(value_t value) const override;
+
+    value_t getByPath(const std::string& path) const override;
+
+    // Heap memory held by the node array, in bytes.
+    size_t memoryUsage() const { return nodes_.capacity() * sizeof(Node); }
+
+  protected:
+    virtual uintptr_t root() const override;
+    virtual bool child(uintptr_t& node, bool right) const override;
+    virtual value_t value(uintptr_t node) const override;
+
+  private:
+    friend class ArrayTreeBuilder;
+
+    using index_t = uint16_t;
+    // The root is always node 0, so 0 never appears as a child index.
+    static constexpr index_t NONE = 0;
+
+    struct Node {
+        value_t value;
+        index_t left, right;
+    };
+
+    std::vector<Node> nodes_;
+};
+
+// Puts an ArrayTree together from the bottom up, the way a Huffman forest
+// is merged, without copying any subtree: nodes are noted down in a scratch
+// array as they're made, and only the finished tree is laid out (in
+// preorder) in the tree's own array. The scratch space is kept from one
+// tree to the next.
+class ArrayTreeBuilder {
+  public:
+    using value_t = Tree::value_t;
+    using node_t = uint16_t;
+
+    // Make a node, returning its handle.
+    // Throws a runtime_error past 16-bit indices' worth of nodes.
+    node_t leaf(value_t value);
+    node_t join(value_t newroot, node_t left, node_t right);
+
+    // Lay out the tree under root in tree's array (replacing the tree it
+    // held, in the same memory if it fits), then start over with no nodes.
+    void build(node_t root, ArrayTree& tree);
+
+    // Heap memory held by the scratch space, in bytes.
+    size_t memoryUsage() const {
+        return nodes_.capacity() * sizeof(Node) + pending_.capacity() * sizeof(Pending);
+    }
+
+  private:
+    static constexpr node_t NONE = UINT16_MAX;
+
+    struct Node {
+        value_t value;
+        node_t left, right;
+    };
+
+    // A node waiting to be laid out, and where to link it in.
+    struct Pending {
+        node_t node;
+        ArrayTree::index_t parent;
+        bool right;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<Pending> pending_;
+
+    node_t add(const Node& node);
+};
+
+} // namespace
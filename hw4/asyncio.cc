@@ -0,0 +1,433 @@
+/*
+ * AsyncReader and AsyncWriter, on top of a minimal io_uring.
+ *
+ * Every request carries a pointer to its bookkeeping as its user data, so
+ * completions can come back in any order; the reader and writer still hand
+ * out (or retire) requests in the order they were made. A read or write
+ * that comes back short is finished off synchronously.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+
+#include "asyncio.hh"
+
+namespace huffman {
+
+    static std::runtime_error io_error(const char* what, int error) {
+        return std::runtime_error(std::string(what) + ": " + std::strerror(error));
+    }
+
+#ifdef HAVE_IO_URING
+
+    /* One submission queue and one completion queue, shared with the
+     * kernel through mmap. Only one thread uses a ring. */
+    class Ring {
+      public:
+        // Set up a ring with room for `entries` requests. Returns null if
+        // io_uring isn't available.
+        static std::unique_ptr<Ring> create(unsigned entries) {
+            std::unique_ptr<Ring> ring(new Ring);
+            return ring->setup(entries) ? std::move(ring) : nullptr;
+        }
+
+        ~Ring() {
+            if (sqes_ != MAP_FAILED) {
+                munmap(sqes_, sqes_size_);
+            }
+            if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+                munmap(cq_ptr_, cq_size_);
+            }
+            if (sq_ptr_ != MAP_FAILED) {
+                munmap(sq_ptr_, sq_size_);
+            }
+            if (fd_ >= 0) {
+                close(fd_);
+            }
+        }
+
+        // Queue a vectored read or write of iov at offset and tell the
+        // kernel about it.
+        void submit(bool write, int fd, const iovec* iov, uint64_t offset, void* user) {
+            const unsigned tail = *sq_tail_;
+            const unsigned index = tail & *sq_mask_;
+            io_uring_sqe& sqe = sqes_[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<uint64_t>(iov);
+            sqe.len = 1;
+            sqe.off = offset;
+            sqe.user_data = reinterpret_cast<uint64_t>(user);
+            sq_array_[index] = index;
+            __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+            enter(1, 0);
+        }
+
+        // Wait for the next completion, and return its user data and result
+        // (a byte count, or minus an errno value).
+        void* wait(int64_t& result) {
+            for (;;) {
+                const unsigned head = *cq_head_;
+                if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                    const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+                    void* user = reinterpret_cast<void*>(cqe.user_data);
+                    result = cqe.res;
+                    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                    return user;
+                }
+                enter(0, 1);
+            }
+        }
+
+      private:
+        int fd_ = -1;
+        void* sq_ptr_ = MAP_FAILED;
+        void* cq_ptr_ = MAP_FAILED;
+        size_t sq_size_ = 0;
+        size_t cq_size_ = 0;
+        io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+        size_t sqes_size_ = 0;
+        unsigned* sq_tail_;
+        unsigned* sq_mask_;
+        unsigned* sq_array_;
+        unsigned* cq_head_;
+        unsigned* cq_tail_;
+        unsigned* cq_mask_;
+        io_uring_cqe* cqes_;
+
+        Ring() = default;
+
+        bool setup(unsigned entries) {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            fd_ = int(syscall(__NR_io_uring_setup, entries, &params));
+            if (fd_ < 0) {
+                return false;
+            }
+
+            sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (single) {
+                sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+            }
+            sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+            if (sq_ptr_ == MAP_FAILED) {
+                return false;
+            }
+            cq_ptr_ = single ? sq_ptr_
+                : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED) {
+                return false;
+            }
+            sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+            void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) {
+                return false;
+            }
+            sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+            char* sq = static_cast<char*>(sq_ptr_);
+            char* cq = static_cast<char*>(cq_ptr_);
+            sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        void enter(unsigned submit, unsigned wait) {
+            const unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+            while (syscall(__NR_io_uring_enter, fd_, submit, wait, flags, nullptr, 0) < 0) {
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    throw io_error("io_uring_enter", errno);
+                }
+            }
+        }
+    };
+
+#else
+
+    /* No io_uring here: readers and writers never get a ring. */
+    class Ring {
+      public:
+        static std::unique_ptr<Ring> create(unsigned) { return nullptr; }
+        void submit(bool, int, const iovec*, uint64_t, void*) { }
+        void* wait(int64_t&) { return nullptr; }
+    };
+
+#endif
+
+    // Give up on a ring that can't be waited on any more: close it, so the
+    // kernel cancels what it can, and leak the buffers of requests that
+    // haven't completed rather than free them while it may still use them.
+    template <typename Request>
+    static void abandon(std::unique_ptr<Ring>& ring,
+                        std::deque<std::unique_ptr<Request>>& requests) {
+        ring.reset();
+        for (auto& request : requests) {
+            if (!request->done) {
+                request.release();
+            }
+        }
+        requests.clear();
+    }
+
+    // Can requests go at explicit offsets in fd? Only for regular files,
+    // and not when every write goes to the end anyway.
+    static bool has_offsets(int fd, uint64_t& position, uint64_t* size = nullptr) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (fcntl(fd, F_GETFL) & O_APPEND)) {
+            return false;
+        }
+        const off_t pos = lseek(fd, 0, SEEK_CUR);
+        if (pos < 0) {
+            return false;
+        }
+        position = pos;
+        if (size) {
+            *size = st.st_size;
+        }
+        return true;
+    }
+
+    AsyncReader::AsyncReader(int fd, size_t chunk_size, unsigned depth)
+        : fd_(fd), chunk_size_(chunk_size), depth_(std::max(depth, 1u))
+    {
+        if (has_offsets(fd_, offset_, &end_)) {
+            ring_ = Ring::create(depth_);
+        }
+        for (unsigned i = 0; ring_ && i < depth_; i++) {
+            submit();
+        }
+    }
+
+    AsyncReader::~AsyncReader() {
+        /* The kernel may still be writing into the buffers. */
+        try {
+            int64_t result;
+            for (auto& request : requests_) {
+                while (ring_ && !request->done) {
+                    static_cast<request_t*>(ring_->wait(result))->done = true;
+                }
+            }
+        } catch (const std::runtime_error&) {
+            abandon(ring_, requests_);
+        }
+    }
+
+    void AsyncReader::submit() {
+        if (offset_ >= end_) {
+            return;
+        }
+        std::unique_ptr<request_t> request(new request_t);
+        request->buffer.resize(std::min<uint64_t>(chunk_size_, end_ - offset_));
+        request->offset = offset_;
+        request->iov = { &request->buffer[0], request->buffer.size() };
+        offset_ += request->buffer.size();
+        ring_->submit(false, fd_, &request->iov, request->offset, request.get());
+        requests_.push_back(std::move(request));
+    }
+
+    std::string AsyncReader::next() {
+        if (!ring_) {
+            std::string chunk(chunk_size_, '\0');
+            size_t got = 0;
+            while (got < chunk.size()) {
+                const auto n = read(fd_, &chunk[got], chunk.size() - got);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0) {
+                    throw io_error("read", errno);
+                }
+                if (n == 0) {
+                    break;
+                }
+                got += n;
+            }
+            chunk.resize(got);
+            return chunk;
+        }
+
+        if (requests_.empty()) {
+            /* Leave the file position where a synchronous read would. */
+            lseek(fd_, end_, SEEK_SET);
+            return std::string();
+        }
+        auto& front = *requests_.front();
+        while (!front.done) {
+            int64_t result;
+            auto request = static_cast<request_t*>(ring_->wait(result));
+            request->done = true;
+            request->result = result;
+        }
+        if (front.result < 0) {
+            throw io_error("read", int(-front.result));
+        }
+
+        /* A short read means the file shrank, or the read was cut short:
+         * read the rest the ordinary way. */
+        auto chunk = std::move(front.buffer);
+        size_t got = front.result;
+        while (got < chunk.size()) {
+            const auto n = pread(fd_, &chunk[got], chunk.size() - got, front.offset + got);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw io_error("read", errno);
+            }
+            if (n == 0) {
+                break;
+            }
+            got += n;
+        }
+        chunk.resize(got);
+        requests_.pop_front();
+        submit();
+        return chunk;
+    }
+
+    AsyncWriter::AsyncWriter(int fd, unsigned depth)
+        : fd_(fd), depth_(std::max(depth, 1u))
+    {
+        if (has_offsets(fd_, offset_)) {
+            ring_ = Ring::create(depth_);
+        }
+    }
+
+    AsyncWriter::~AsyncWriter() {
+        /* The kernel may still be reading from the buffers. */
+        while (!requests_.empty()) {
+            try {
+                retireOldest();
+            } catch (const std::runtime_error&) {
+                /* A failed write is retired anyway; a failed wait isn't,
+                 * and waiting again would only fail again. */
+                if (!requests_.front()->done) {
+                    abandon(ring_, requests_);
+                }
+            }
+        }
+    }
+
+    void AsyncWriter::write(std::vector<char> bytes) {
+        std::unique_ptr<request_t> request(new request_t);
+        request->owned = std::move(bytes);
+        request->data = request->owned.data();
+        request->size = request->owned.size();
+        submit(std::move(request));
+    }
+
+    void AsyncWriter::write(const char* data, size_t size) {
+        std::unique_ptr<request_t> request(new request_t);
+        request->data = data;
+        request->size = size;
+        submit(std::move(request));
+    }
+
+    std::vector<char> AsyncWriter::spare() {
+        if (spares_.empty()) {
+            return std::vector<char>();
+        }
+        auto bytes = std::move(spares_.back());
+        spares_.pop_back();
+        bytes.clear();
+        return bytes;
+    }
+
+    void AsyncWriter::keepSpare(std::vector<char>& bytes) {
+        /* Callers that never ask for spares mustn't pile them up. */
+        if (bytes.capacity() && spares_.size() < depth_) {
+            spares_.push_back(std::move(bytes));
+        }
+    }
+
+    void AsyncWriter::submit(std::unique_ptr<request_t> request) {
+        if (request->size == 0) {
+            return;
+        }
+        if (!ring_) {
+            for (size_t done = 0; done < request->size; ) {
+                const auto n = ::write(fd_, request->data + done, request->size - done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0) {
+                    throw io_error("write", errno);
+                }
+                done += n;
+            }
+            keepSpare(request->owned);
+            return;
+        }
+
+        while (requests_.size() >= depth_) {
+            retireOldest();
+        }
+        request->offset = offset_;
+        request->iov = { const_cast<char*>(request->data), request->size };
+        offset_ += request->size;
+        ring_->submit(true, fd_, &request->iov, request->offset, request.get());
+        requests_.push_back(std::move(request));
+    }
+
+    void AsyncWriter::retireOldest() {
+        auto& front = *requests_.front();
+        while (!front.done) {
+            int64_t result;
+            auto request = static_cast<request_t*>(ring_->wait(result));
+            request->done = true;
+            request->result = result;
+        }
+        const auto error = front.result < 0 ? int(-front.result) : 0;
+        size_t done = error ? 0 : front.result;
+        while (!error && done < front.size) {
+            const auto n = pwrite(fd_, front.data + done, front.size - done, front.offset + done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                requests_.pop_front();
+                throw io_error("write", errno);
+            }
+            done += n;
+        }
+        keepSpare(front.owned);
+        requests_.pop_front();
+        if (error) {
+            throw io_error("write", error);
+        }
+    }
+
+    void AsyncWriter::finish() {
+        if (!ring_) {
+            return;
+        }
+        while (!requests_.empty()) {
+            retireOldest();
+        }
+        lseek(fd_, offset_, SEEK_SET);
+    }
+
+} // namespace huffman
@@ -0,0 +1,121 @@
+/*
+ * asyncio.hh: reading and writing files with several requests queued at
+ * once, so the disk keeps working while the caller codes other blocks.
+ *
+ * On Linux, requests go through io_uring (set up with the raw system
+ * calls, so there's nothing extra to link). Where io_uring isn't there (an
+ * old kernel, a sandbox that blocks it) or can't help (pipes, which have
+ * no offsets, and files opened for appending), the same calls simply read
+ * and write synchronously.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+namespace huffman {
+
+class Ring;
+
+// Reads a file descriptor from its current position to the end, in chunks
+// of a fixed size, keeping up to `depth` chunks read ahead.
+class AsyncReader {
+  public:
+    AsyncReader(int fd, size_t chunk_size, unsigned depth = 4);
+    ~AsyncReader();
+
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+
+    // The next chunk of input: chunk_size bytes, fewer only at the end of
+    // the input, and none past it.
+    // Throws a runtime_error if reading fails.
+    std::string next();
+
+    // Is this reader queueing its reads (rather than reading synchronously)?
+    bool queued() const { return ring_ != nullptr; }
+
+  private:
+    struct request_t {
+        std::string buffer;
+        uint64_t offset;
+        iovec iov;
+        bool done = false;
+        int64_t result = 0;
+    };
+
+    int fd_;
+    size_t chunk_size_;
+    unsigned depth_;
+    std::unique_ptr<Ring> ring_;
+    uint64_t offset_ = 0;  // Where the next read starts
+    uint64_t end_ = 0;     // Size of the file
+    std::deque<std::unique_ptr<request_t>> requests_;
+
+    void submit();
+};
+
+// Writes a sequence of buffers to a file descriptor from its current
+// position, keeping up to `depth` writes in flight.
+class AsyncWriter {
+  public:
+    AsyncWriter(int fd, unsigned depth = 8);
+    // Finishes any writes still in flight (ignoring errors; call finish()
+    // to see them).
+    ~AsyncWriter();
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    // Queue a write of bytes, which the writer keeps until it's done.
+    // Throws a runtime_error if an earlier write failed.
+    void write(std::vector<char> bytes);
+
+    // Queue a write of the `size` bytes at data, which must stay valid
+    // until finish().
+    // Throws a runtime_error if an earlier write failed.
+    void write(const char* data, size_t size);
+
+    // The buffer of an owned write that's done, emptied (but keeping its
+    // capacity) for the caller to fill and write again, or an empty vector
+    // if none is done yet.
+    std::vector<char> spare();
+
+    // Wait for every queued write, and leave the file position just past
+    // the last one.
+    // Throws a runtime_error if a write failed.
+    void finish();
+
+    // Is this writer queueing its writes (rather than writing synchronously)?
+    bool queued() const { return ring_ != nullptr; }
+
+  private:
+    struct request_t {
+        std::vector<char> owned;
+        const char* data;
+        size_t size;
+        uint64_t offset;
+        iovec iov;
+        bool done = false;
+        int64_t result = 0;
+    };
+
+    int fd_;
+    unsigned depth_;
+    std::unique_ptr<Ring> ring_;
+    uint64_t offset_ = 0;  // Where the next write starts
+    std::deque<std::unique_ptr<request_t>> requests_;
+    std::vector<std::vector<char>> spares_;  // Buffers of finished writes
+
+    void keepSpare(std::vector<char>& bytes);
+    void submit(std::unique_ptr<request_t> request);
+    void retireOldest();
+};
+
+} // namespace
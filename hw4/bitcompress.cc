@@ -6,59 +6,391 @@
  * standard output. Use shell redicrection to compress files.
  */
 
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <memory>
 #include <string>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "asyncio.hh"
+#include "bitio.hh"
+#include "block.hh"
+#include "codebook.hh"
+#include "frame.hh"
+#include "header.hh"
 #include "huffman.hh"
+#include "mapped.hh"
+#include "options.hh"
+#include "pipeline.hh"
+#include "workers.hh"
 
 using namespace std;
+using namespace huffman;
 
-void addnewbit(std::vector<char>& vec, unsigned index, huffman::Huffman::bit_t bit) {
-    unsigned byte_index = index / 8;
-    unsigned bit_index = index % 8;
-    while (byte_index >= vec.size()) {
-        vec.push_back(0);
+// Pack bits into bytes, first bit in the least significant bit of a byte.
+std::vector<char> pack_bits(const Huffman::encoding_t& bits) {
+    BitWriter writer;
+    writer.write(bits);
+    return writer.finish();
+}
+
+// How much input is read (and coded) at a time.
+constexpr uint64_t CHUNK_SIZE = 1 << 20;
+
+// A piece of the input: either a view of a mapped file, or its own copy of
+// bytes read from stdin.
+using chunk_t = block_input_t;
+
+// Where the input comes from: a file mapped with -i, or else stdin.
+class Input {
+  public:
+    // Map the file at path, or read stdin if path is null.
+    // Throws a runtime_error if the file can't be mapped.
+    explicit Input(const char* path) {
+        if (path) {
+            mapped_.reset(new MappedInput(path));
+        }
+    }
+
+    // From now on, read stdin in chunks of `size` bytes with a few reads
+    // queued ahead (see asyncio.hh), and pass that same size to next().
+    void readAhead(uint64_t size) {
+        if (!mapped_) {
+            reader_.reset(new AsyncReader(fileno(stdin), size));
+        }
+    }
+
+    // The next `size` bytes of input; fewer only at its end.
+    // Throws a runtime_error if reading fails.
+    chunk_t next(uint64_t size) {
+        chunk_t chunk;
+        if (reader_) {
+            chunk.bytes = reader_->next();
+            chunk.size = chunk.bytes.size();
+            return chunk;
+        }
+        if (mapped_) {
+            chunk.view = mapped_->data() + pos_;
+            chunk.size = min<uint64_t>(size, mapped_->size() - pos_);
+            pos_ += chunk.size;
+            return chunk;
+        }
+        auto& input = chunk.bytes;
+        while (input.size() < size) {
+            const auto have = input.size();
+            const auto want = min<uint64_t>(size - have, CHUNK_SIZE);
+            input.resize(have + want);
+            const auto got = fread(&input[have], 1, want, stdin);
+            input.resize(have + got);
+            if (got < want) {
+                break;
+            }
+        }
+        chunk.size = input.size();
+        return chunk;
+    }
+
+    // The number of bytes left, if it can be told up front (a pipe can't
+    // tell until it's been read).
+    bool size(uint64_t& size) const {
+        if (mapped_) {
+            size = mapped_->size() - pos_;
+            return true;
+        }
+        struct stat st;
+        const auto start = ftell(stdin);
+        if (fstat(fileno(stdin), &st) != 0 || !S_ISREG(st.st_mode) || start < 0
+                || st.st_size < start) {
+            return false;
+        }
+        size = st.st_size - start;
+        return true;
     }
-    vec[byte_index] |= (bit << bit_index);
+
+    // Remember the current position, to come back to with rewind(). Returns
+    // false if the input can't be read twice.
+    bool mark() {
+        if (mapped_) {
+            mark_ = pos_;
+            return true;
+        }
+        mark_ = ftell(stdin);
+        return mark_ >= 0 && fseek(stdin, mark_, SEEK_SET) == 0;
+    }
+
+    // Go back to the position mark() remembered. Returns false on failure.
+    bool rewind() {
+        if (mapped_) {
+            pos_ = mark_;
+            return true;
+        }
+        return fseek(stdin, mark_, SEEK_SET) == 0;
+    }
+
+  private:
+    unique_ptr<MappedInput> mapped_;
+    unique_ptr<AsyncReader> reader_;
+    uint64_t pos_ = 0;  // Position in the mapped file
+    long mark_ = 0;
+};
+
+// Write a frame header for frame to out.
+void write_frame(const frame_t& frame, FILE* out) {
+    vector<char> bytes;
+    write_frame_header(bytes, frame);
+    fwrite(bytes.data(), 1, bytes.size(), out);
+}
+
+void usage(const char* prog)
+{
+  cerr << "Usage: " << prog << " [-v] [-p interval | -g cap | -s | -b size] [-l length] [-T threads]\n"
+       << "       [-S streams] [-i input] [-o output]\n"
+       << "  -v           print each symbol as it is encoded\n"
+       << "  -p interval  rebuild the code every `interval` symbols\n"
+       << "  -g cap       rebuild after 1, 2, 4... symbols, at most `cap` apart\n"
+       << "  -s           build one static code for the whole input (two passes)\n"
+       << "  -b size      build a static code for each block of `size` bytes\n"
+       << "               (K and M suffixes are accepted, e.g. 64K or 4M)\n"
+       << "  -T threads   code blocks on `threads` worker threads (implies -b 1M\n"
+       << "               unless -b is given)\n"
+       << "  -S streams   interleave each block's codes in `streams` streams, which\n"
+       << "               decode faster (implies -b 1M unless -b is given)\n"
+       << "  -l length    with -p, -g, -s or -b, never assign codes longer than `length`\n"
+       << "  -i input     map the file `input` instead of reading standard input\n"
+       << "  -o output    write to the file `output` instead of standard output\n"
+       << "By default the code is updated adaptively after every symbol.\n";
 }
 
 int main(int argc, char** argv)
 {
-  const bool verbose = argc > 1 && string(argv[1]) == "-v";
-  huffman::Huffman huff;
+  bool verbose = false;
+  Huffman::config_t config;
+  block_config_t layout;
+  uint64_t block_size = 0;
+  unsigned threads = 1;
+  const char* input_path = nullptr;
+  const char* output_path = nullptr;
+  const auto max_interval = numeric_limits<uint32_t>::max();
+  for (int opt; (opt = getopt(argc, argv, "vp:g:sb:l:T:S:i:o:")) != -1; ) {
+      switch (opt) {
+        case 'v':
+          verbose = true;
+          break;
+        case 'p':
+          config.update = Huffman::update_t::REBUILD;
+          config.interval = parse_count(optarg, "interval", max_interval);
+          break;
+        case 'g':
+          config.update = Huffman::update_t::GEOMETRIC;
+          config.interval = parse_count(optarg, "cap", max_interval);
+          break;
+        case 's':
+          config.update = Huffman::update_t::STATIC;
+          break;
+        case 'b':
+          block_size = parse_size(optarg, "block size", MAX_BLOCK_SIZE);
+          break;
+        case 'T':
+          threads = parse_count(optarg, "thread count", 1024);
+          if (!block_size) {
+              block_size = 1 << 20;
+          }
+          break;
+        case 'S':
+          layout.streams = parse_count(optarg, "number of streams", MAX_STREAMS);
+          if (!block_size) {
+              block_size = 1 << 20;
+          }
+          break;
+        case 'l':
+          config.max_length = parse_count(optarg, "maximum code length", CodeBook::MAX_LENGTH);
+          if (config.max_length < Huffman::MIN_LENGTH) {
+              cerr << "Maximum code length must be at least " << Huffman::MIN_LENGTH << "\n";
+              return 1;
+          }
+          break;
+        case 'i':
+          input_path = optarg;
+          break;
+        case 'o':
+          output_path = optarg;
+          break;
+        default:
+          usage(argv[0]);
+          return 1;
+      }
+  }
+  if (block_size && config.update != Huffman::update_t::ADAPTIVE &&
+          config.update != Huffman::update_t::STATIC) {
+      cerr << "Blocks (-b, -T, -S) can't be combined with -p or -g\n";
+      return 1;
+  }
+  if (block_size) {
+      config.update = Huffman::update_t::STATIC;
+  }
+  Huffman huff(config);
 
-  std::vector<char> encoded;
-  unsigned bitindex = 0;
+  unique_ptr<Input> in;
+  try {
+      in.reset(new Input(input_path));
+  } catch (const runtime_error& e) {
+      cerr << e.what() << "\n";
+      return 1;
+  }
+  FILE* out = stdout;
+  if (output_path && !(out = fopen(output_path, "wb"))) {
+      perror(output_path);
+      return 1;
+  }
 
-  // Read in all of stdin, line by line.
-  // Iterate over input characters, output their encoding
-  // and update their frequency:
-  for (string line; getline(cin, line); ) {
-      for (auto c : line + '\n') {
-          if (verbose)  cout << c << "\t";
-          for (auto bit : huff.encode(c)) {
-              addnewbit(encoded, bitindex, bit);
-              bitindex ++;
-          }
-          huff.incFreq(c);
-          if (verbose) cout << "\n";
+  // The frame header holds the input's length when it's known up front:
+  frame_t frame;
+  frame.blocks = block_size > 0;
+  frame.sized = in->size(frame.length);
+  uint64_t length = 0;
+
+  // Blocks carry their own codes, so only the header goes in front. Each
+  // block is coded and packed into bytes on a worker thread, and the results
+  // are written out in order, with a couple of blocks per worker in flight.
+  // Reads and writes are queued too, so neither the disk nor the coders
+  // wait on each other. The index of where each block landed goes at the
+  // end:
+  if (block_size) try {
+      in->readAhead(block_size);
+      fflush(out);
+      AsyncWriter writer(fileno(out));
+      vector<char> bytes;
+      write_frame_header(bytes, frame);
+      writer.write(move(bytes));
+      auto header = pack_bits([&]() {
+          Huffman::encoding_t bits;
+          layout.blocks = true;
+          write_header(bits, config, layout);
+          return bits;
+      }());
+      uint64_t offset = header.size();
+      writer.write(move(header));
+      block_index_t index;
+
+      WorkerPool workers(threads);
+      encode_blocks(workers, config, layout.streams,
+          [&]() { return in->next(block_size); },
+          [&](vector<char> bytes, uint64_t count) {
+              index.push_back({ offset, count });
+              length += count;
+              offset += bytes.size();
+              writer.write(move(bytes));
+          });
+
+      BitWriter end_marker;
+      encode_block(nullptr, 0, config, end_marker);
+      Huffman::encoding_t trailer;
+      write_block_index(trailer, index, offset + end_marker.bitCount() / 8);
+      end_marker.write(trailer);
+      bytes = end_marker.finish();
+      write_frame_end(bytes, length);
+      writer.write(move(bytes));
+      writer.finish();
+      if (frame.sized && length != frame.length) {
+          cerr << "The input changed size while it was compressed\n";
+          return 1;
       }
+      return 0;
+  } catch (const runtime_error& e) {
+      cerr << e.what() << "\n";
+      return 1;
   }
 
-  // Finally, output end-of-file code
-  if (verbose) cout << "EOF\t";
-  for (auto bit : huff.eofCode()) {
-      addnewbit(encoded, bitindex, bit);
-      bitindex ++;
+  // Start with the header, so the decoder can build the same model.
+  // A static code is built from the whole input up front, and its code
+  // lengths go into the header too. That takes two passes: a seekable
+  // (or mapped) input is simply read twice, anything else is kept in
+  // memory. Either way, the first pass finds the input's length:
+  Huffman::encoding_t header;
+  write_header(header, config);
+  string kept;
+  if (config.update == Huffman::update_t::STATIC) {
+      const bool seekable = in->mark();
+      frame.length = 0;
+      for (chunk_t input; (input = in->next(CHUNK_SIZE)).size; ) {
+          for (size_t i = 0; i < input.size; i++) {
+              huff.incFreq(input.data()[i]);
+          }
+          frame.length += input.size;
+          if (!seekable) {
+              kept += input.bytes;
+          }
+      }
+      frame.sized = true;
+      if (seekable && !in->rewind()) {
+          perror("Can't rewind the input");
+          return 1;
+      }
+      huff.rebuild();
+      write_lengths(header, huff.codeLengths());
   }
-  if (verbose) cout << "\n";
+  write_frame(frame, out);
+  BitWriter writer;
+  writer.write(header);
 
-  for (auto c : encoded) {
-      printf("%c", c);
+  // Iterate over input characters, output their encoding
+  // and update their frequency. Reading, coding and writing each run on
+  // their own thread, a chunk at a time, so the coder never waits on I/O and
+  // memory use stays flat:
+  try {
+      bool kept_read = false;
+      run_pipeline<chunk_t, vector<char>>(
+          [&](chunk_t& input) {
+              if (!kept.empty()) {
+                  input.bytes.swap(kept);
+                  input.size = input.bytes.size();
+                  kept_read = true;
+                  return true;
+              }
+              if (kept_read) {
+                  return false;
+              }
+              input = in->next(CHUNK_SIZE);
+              return input.size > 0;
+          },
+          [&](const chunk_t& input, vector<char>& encoded) {
+              for (size_t i = 0; i < input.size; i++) {
+                  const auto c = input.data()[i];
+                  if (verbose)  cout << c << "\t";
+                  huff.encode(c, writer);
+                  huff.incFreq(c);
+                  if (verbose) cout << "\n";
+              }
+              length += input.size;
+              writer.drain(encoded);
+          },
+          [&](vector<char>& encoded) {
+              // Finally, output end-of-file code, unless the decoder knows
+              // where the input ends:
+              if (!frame.sized) {
+                  if (verbose) cout << "EOF\t";
+                  huff.eofCode(writer);
+                  if (verbose) cout << "\n";
+              }
+              encoded = writer.finish();
+              write_frame_end(encoded, length);
+          },
+          [&](const vector<char>& encoded) {
+              if (fwrite(encoded.data(), 1, encoded.size(), out) != encoded.size()) {
+                  throw runtime_error("Can't write the output");
+              }
+          });
+  } catch (const runtime_error& e) {
+      cerr << e.what() << "\n";
+      return 1;
+  }
+  if (frame.sized && length != frame.length) {
+      cerr << "The input changed size while it was compressed\n";
+      return 1;
   }
-  printf("\n");
 
   return 0;
 }
-
@@ -6,60 +6,322 @@
  * standard output. Use shell redicrection to compress files.
  */
 
+#include <cstdio>
 #include <iostream>
 #include <algorithm>
 #include <string>
-#include <cassert>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "asyncio.hh"
+#include "bitio.hh"
+#include "block.hh"
+#include "decoder.hh"
+#include "frame.hh"
+#include "header.hh"
 #include "huffman.hh"
+#include "mapped.hh"
+#include "options.hh"
+#include "pipeline.hh"
+#include "workers.hh"
 
 using namespace std;
 using namespace huffman;
 
-/* NOTE: small bug: if the original input happened to encode
- * to something containing byte 10 (newline), this will get
- * cut off at that point because it only gets one line.
- * I'll maybe go back and fix this. */
-Huffman::encoding_t string_to_bits(std::string str) {
-    Huffman::encoding_t bits;
-    for (auto c : str) {
-        for (unsigned i = 0; i < 8; i++) {
-            if (c & (1 << i)) {
-                bits.push_back(huffman::Huffman::ONE);
-            } else {
-                bits.push_back(huffman::Huffman::ZERO);
-            }
-        }
-    }
-    return bits;
+// Compressed input is decoded this many bytes at a time.
+const size_t CHUNK_SIZE = 64 << 10;
+
+// Decode the blocks listed in index into output, which has room for exactly
+// `length` symbols, on `threads` worker threads. Every block's place in the
+// output is known up front, so each worker writes its own part of it.
+void decode_blocks(const char* begin, const char* end, const block_index_t& index,
+                   unsigned streams, unsigned threads, char* output, uint64_t length)
+{
+  vector<uint64_t> out_offsets;
+  uint64_t total = 0;
+  for (const auto& entry : index) {
+      out_offsets.push_back(total);
+      total += entry.count;
+  }
+  if (total != length) {
+      throw runtime_error("stream length doesn't match its frame!");
+  }
+
+  WorkerPool workers(threads);
+  vector<future<void>> done;
+  for (size_t i = 0; i < index.size(); i++) {
+      done.push_back(workers.submit([&, i]() {
+          BitReader in(begin, index[i].offset * 8, 8 * uint64_t(end - begin));
+          string block;
+          if (decode_block(in, block, streams) != index[i].count) {
+              throw runtime_error("block doesn't match the index!");
+          }
+          memcpy(output + out_offsets[i], block.data(), block.size());
+      }));
+  }
+  for (auto& block : done) {
+      block.get();
+  }
 }
 
-int main(int, char**)
+// Decode the blocks listed in index on `threads` worker threads and write
+// them out in order. Only a couple of blocks per thread are decoded ahead of
+// the writer, each into a buffer that an earlier block was written from, so
+// memory use doesn't grow with the output.
+void write_blocks(const char* begin, const char* end, const block_index_t& index,
+                  unsigned streams, unsigned threads, uint64_t length, AsyncWriter& writer)
 {
-  huffman::Huffman huff;
-
-  // Assuming input is a single line, read it all into a string:
-  string line;
-  getline(cin, line);
-
-  // And convert it to bit_t:
-  Huffman::encoding_t input = string_to_bits(line);
-  auto b = input.cbegin();
-  auto e = input.cend();
-
-  // Iterate over input bits, output their decoding
-  // and update their frequency:
-  while (b != e) {
-      const auto symbol = huff.decode(b, e);
-      assert(b <= e);
-      if (!symbol && b==e) {
+  uint64_t total = 0;
+  for (const auto& entry : index) {
+      total += entry.count;
+  }
+  if (total != length) {
+      throw runtime_error("stream length doesn't match its frame!");
+  }
+
+  WorkerPool workers(threads);
+  deque<future<vector<char>>> pending;
+  auto write_oldest = [&]() {
+      writer.write(pending.front().get());
+      pending.pop_front();
+  };
+  for (size_t i = 0; i < index.size(); i++) {
+      pending.push_back(workers.submit([&, i, block = writer.spare()]() mutable {
+          BitReader in(begin, index[i].offset * 8, 8 * uint64_t(end - begin));
+          if (decode_block(in, block, streams) != index[i].count) {
+              throw runtime_error("block doesn't match the index!");
+          }
+          return move(block);
+      }));
+      if (pending.size() > 2 * workers.size()) {
+          write_oldest();
+      }
+  }
+  while (!pending.empty()) {
+      write_oldest();
+  }
+}
+
+// The length of the original input, from the end marker of the whole
+// compressed stream in the `size` bytes at data.
+uint64_t stream_length(const char* data, size_t size)
+{
+  if (size < FRAME_HEADER_SIZE + FRAME_END_SIZE) {
+      throw runtime_error("stream is truncated!");
+  }
+  const auto length = read_frame_end(data + size - FRAME_END_SIZE, FRAME_END_SIZE);
+  // Every code takes at least a bit, so a (corrupt) length can't run away:
+  if (length / 8 > size) {
+      throw runtime_error("stream length doesn't match its frame!");
+  }
+  return length;
+}
+
+// Decode the whole compressed stream in the `size` bytes at data, `length`
+// symbols long, passing each decoded piece to place() in order. A block
+// stream with an index goes to blocks(begin, end, index, streams) instead,
+// to be decoded in parallel.
+template <typename Blocks, typename Place>
+void decode_stream(const char* data, size_t size, uint64_t length, Blocks blocks, Place place)
+{
+  const auto frame = read_frame_header(data, size);
+  if (frame.sized && frame.length != length) {
+      throw runtime_error("stream length doesn't match its frame!");
+  }
+
+  // The stream itself lies between the frame header and end marker:
+  const char* begin = data + FRAME_HEADER_SIZE;
+  const char* end = data + size - FRAME_END_SIZE;
+  block_index_t index;
+  if (frame.blocks && read_block_index(begin, end, index)) {
+      BitReader in(begin, end);
+      block_config_t layout;
+      read_header(in, &layout);
+      blocks(begin, end, index, layout.streams);
+      return;
+  }
+
+  // Otherwise, decode it a piece at a time:
+  StreamDecoder decoder;
+  string decoded;
+  uint64_t written = 0;
+  auto place_decoded = [&]() {
+      if (decoded.size() > length - written) {
+          throw runtime_error("stream length doesn't match its frame!");
+      }
+      place(decoded);
+      written += decoded.size();
+      decoded.clear();
+  };
+  for (size_t pos = 0; pos < size && !decoder.done(); pos += CHUNK_SIZE) {
+      decoder.push(data + pos, min(CHUNK_SIZE, size - pos), decoded);
+      place_decoded();
+  }
+  decoder.finish(decoded);
+  place_decoded();
+  if (written != length) {
+      throw runtime_error("stream length doesn't match its frame!");
+  }
+}
+
+// Decode the whole compressed stream in the `size` bytes at data into
+// output, which has room for exactly the length stream_length() found.
+void decode_all(const char* data, size_t size, char* output, unsigned threads)
+{
+  const auto length = stream_length(data, size);
+  uint64_t written = 0;
+  decode_stream(data, size, length,
+      [&](const char* begin, const char* end, const block_index_t& index, unsigned streams) {
+          decode_blocks(begin, end, index, streams, threads, output, length);
+      },
+      [&](const string& decoded) {
+          memcpy(output + written, decoded.data(), decoded.size());
+          written += decoded.size();
+      });
+}
+
+// Decode the whole compressed stream in the `size` bytes at data, queueing
+// it for writing as it's decoded.
+void write_all(const char* data, size_t size, unsigned threads, AsyncWriter& writer)
+{
+  const auto length = stream_length(data, size);
+  decode_stream(data, size, length,
+      [&](const char* begin, const char* end, const block_index_t& index, unsigned streams) {
+          write_blocks(begin, end, index, streams, threads, length, writer);
+      },
+      [&](const string& decoded) {
+          auto bytes = writer.spare();
+          bytes.assign(decoded.begin(), decoded.end());
+          writer.write(move(bytes));
+      });
+}
+
+// Does the regular file fd hold a block stream (from its current position)?
+// Only those gain from being read whole, to decode their blocks in parallel.
+bool holds_blocks(int fd)
+{
+  char header[FRAME_HEADER_SIZE];
+  const auto offset = lseek(fd, 0, SEEK_CUR);
+  if (offset < 0 || pread(fd, header, sizeof(header), offset) != ssize_t(sizeof(header))) {
+      return false;
+  }
+  try {
+      return read_frame_header(header, sizeof(header)).blocks;
+  } catch (const runtime_error&) {
+      return false;  // Let the decoder report it
+  }
+}
+
+void usage(const char* prog)
+{
+  cerr << "Usage: " << prog << " [-T threads] [-i input] [-o output]\n"
+       << "  -T threads   decode blocks on `threads` worker threads (by default,\n"
+       << "               one per core)\n"
+       << "  -i input     read the file `input` instead of standard input\n"
+       << "  -o output    map the file `output` (sized to fit) instead of writing\n"
+       << "               standard output\n";
+}
+
+int main(int argc, char** argv)
+{
+  unsigned threads = max(thread::hardware_concurrency(), 1u);
+  const char* input_path = nullptr;
+  const char* output_path = nullptr;
+  for (int opt; (opt = getopt(argc, argv, "T:i:o:")) != -1; ) {
+      switch (opt) {
+        case 'T':
+          threads = parse_count(optarg, "thread count", 1024);
+          break;
+        case 'i':
+          input_path = optarg;
+          break;
+        case 'o':
+          output_path = optarg;
           break;
-      } else {
-          cout << symbol;
-          huff.incFreq(symbol);
+        default:
+          usage(argv[0]);
+          return 1;
+      }
+  }
+
+  FILE* in = stdin;
+  if (input_path && !(in = fopen(input_path, "rb"))) {
+      perror(input_path);
+      return 1;
+  }
+
+  // A block stream in a regular file is mapped whole, to decode its blocks in
+  // parallel, and so is any regular file decoded into a mapped output (-o).
+  // Anything else is decoded as it arrives, so memory use doesn't grow with
+  // the size of the input or the output.
+  struct stat st;
+  const bool regular = fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode);
+  if (regular && (output_path || holds_blocks(fileno(in)))) {
+      try {
+          // Stdin is mapped from its current position, and left at its end:
+          unique_ptr<MappedInput> mapped(input_path
+              ? new MappedInput(input_path)
+              : new MappedInput(STDIN_FILENO, "standard input"));
+          const char* data = mapped->data();
+          const size_t size = mapped->size();
+          if (output_path) {
+              MappedOutput output(output_path, stream_length(data, size));
+              decode_all(data, size, output.data(), threads);
+          } else {
+              AsyncWriter writer(STDOUT_FILENO);
+              write_all(data, size, threads, writer);
+              writer.finish();
+          }
+          if (!input_path) {
+              lseek(STDIN_FILENO, 0, SEEK_END);
+          }
+      } catch (const runtime_error& e) {
+          cerr << e.what() << "\n";
+          return 1;
       }
+      return 0;
+  }
+
+  FILE* out = stdout;
+  if (output_path && !(out = fopen(output_path, "wb"))) {
+      perror(output_path);
+      return 1;
+  }
+
+  // Decode each chunk as it comes in, and write out whatever it completes.
+  // Reading, decoding and writing each run on their own thread:
+  try {
+      StreamDecoder decoder;
+      run_pipeline<vector<char>, string>(
+          [&](vector<char>& chunk) {
+              chunk.resize(CHUNK_SIZE);
+              chunk.resize(fread(chunk.data(), 1, chunk.size(), in));
+              if (chunk.empty() && ferror(in)) {
+                  throw runtime_error("Can't read the input");
+              }
+              return !chunk.empty();
+          },
+          [&](const vector<char>& chunk, string& output) {
+              decoder.push(chunk.data(), chunk.size(), output);
+          },
+          [&](string& output) {
+              decoder.finish(output);
+          },
+          [&](const string& output) {
+              if (fwrite(output.data(), 1, output.size(), out) != output.size()) {
+                  throw runtime_error("Can't write the output");
+              }
+          });
+  } catch (const runtime_error& e) {
+      cerr << e.what() << "\n";
+      return 1;
   }
 
   return 0;
 }
-
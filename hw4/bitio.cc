@@ -0,0 +1,118 @@
+/*
+ * BitWriter and BitReader: word-at-a-time bit packing.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "bitio.hh"
+
+namespace huffman {
+
+    void BitWriter::write(const Huffman::encoding_t& code) {
+        /* Gather the bits into words rather than writing them one by one. */
+        uint64_t bits = 0;
+        unsigned length = 0;
+        for (auto bit : code) {
+            bits |= uint64_t(bit == Huffman::ONE) << length;
+            if (++length == 64) {
+                write(bits, length);
+                bits = 0;
+                length = 0;
+            }
+        }
+        write(bits, length);
+    }
+
+    void BitWriter::append(const BitWriter& other) {
+        /* other's bytes always come in whole words. */
+        for (size_t i = 0; i < other.bytes_.size(); i += 8) {
+            uint64_t word = 0;
+            for (unsigned j = 0; j < 8; j++) {
+                word |= uint64_t(uint8_t(other.bytes_[i + j])) << (8 * j);
+            }
+            write(word, 64);
+        }
+        write(other.acc_, other.count_);
+    }
+
+    void BitWriter::alignToByte() {
+        write(0, (8 - count_ % 8) % 8);
+    }
+
+    std::vector<char> BitWriter::finish() {
+        alignToByte();
+        for (unsigned i = 0; i < count_; i += 8) {
+            bytes_.push_back(char(acc_ >> i));
+        }
+        acc_ = 0;
+        count_ = 0;
+        drained_ = 0;
+        std::vector<char> bytes;
+        bytes.swap(bytes_);
+        return bytes;
+    }
+
+    void BitWriter::drain(std::vector<char>& out) {
+        drained_ += bytes_.size();
+        out.clear();
+        out.swap(bytes_);
+    }
+
+    void BitWriter::flushWord() {
+        const auto size = bytes_.size();
+        bytes_.resize(size + 8);
+        for (unsigned i = 0; i < 8; i++) {
+            bytes_[size + i] = char(acc_ >> (8 * i));
+        }
+    }
+
+    BitReader::BitReader(const char* data, uint64_t first, uint64_t last)
+        : data_(reinterpret_cast<const uint8_t*>(data)),
+          next_(data_ + first / 8),
+          end_(data_ + (last + 7) / 8),
+          tail_(unsigned((8 - last % 8) % 8))
+    {
+        if (first > last) {
+            throw std::runtime_error("invalid bit range!");
+        }
+        refill();
+        skip(first % 8);
+    }
+
+    BitReader BitReader::take(uint64_t count) {
+        if (count > bitsLeft()) {
+            throw std::runtime_error("bit stream is truncated!");
+        }
+        const auto first = position();
+        const auto last = 8 * uint64_t(end_ - data_) - tail_;
+        const auto data = reinterpret_cast<const char*>(data_);
+        *this = BitReader(data, first + count, last);
+        return BitReader(data, first, first + count);
+    }
+
+    uint64_t BitReader::read(unsigned count) {
+        if (count > count_) {
+            throw std::runtime_error("bit stream is truncated!");
+        }
+        const auto bits = peek(count);
+        skip(count);
+        return bits;
+    }
+
+    Huffman::encoding_t unpack_bits(const char* begin, const char* end) {
+        BitReader reader(begin, end);
+        Huffman::encoding_t bits;
+        bits.reserve(reader.bitsLeft());
+        while (reader.bitsLeft()) {
+            const auto count = unsigned(std::min<uint64_t>(reader.bitsLeft(),
+                                                           BitReader::MAX_PEEK));
+            const auto word = reader.read(count);
+            for (unsigned i = 0; i < count; i++) {
+                bits.push_back(Huffman::bit_t((word >> i) & 1));
+            }
+        }
+        return bits;
+    }
+
+} // namespace huffman
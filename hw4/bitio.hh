@@ -0,0 +1,154 @@
+/*
+ * bitio.hh: packing bits into bytes and reading them back, a whole word at
+ * a time. Bits are packed least significant first within each byte, and a
+ * group of bits written or read together has its first bit in the least
+ * significant position (the order CodeBook keeps its codes in).
+ *
+ * Both sides keep up to 64 bits in an accumulator, so writing or reading a
+ * whole code costs a shift and an OR, and the bytes move eight at a time.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "huffman.hh"
+
+namespace huffman {
+
+class BitWriter {
+  public:
+    // Append the lowest `length` bits of bits (length at most 64), first
+    // bit in the least significant position.
+    void write(uint64_t bits, unsigned length) {
+        if (length == 0) {
+            return;
+        }
+        if (length < 64) {
+            bits &= (uint64_t(1) << length) - 1;
+        }
+        acc_ |= bits << count_;
+        if (count_ + length < 64) {
+            count_ += length;
+            return;
+        }
+        flushWord();
+        acc_ = count_ ? bits >> (64 - count_) : 0;
+        count_ = count_ + length - 64;
+    }
+
+    // Append a code given as a vector of bits.
+    void write(const Huffman::encoding_t& code);
+
+    // Append everything written to other so far.
+    void append(const BitWriter& other);
+
+    // Append zero bits up to the next byte boundary.
+    void alignToByte();
+
+    // Number of bits written so far.
+    uint64_t bitCount() const { return (drained_ + bytes_.size()) * 8 + count_; }
+
+    // Move the bytes written so far into out (replacing its contents),
+    // except for the last few bits that don't fill a word yet. Lets a
+    // caller write out a long stream as it goes.
+    void drain(std::vector<char>& out);
+
+    // Pad to a whole byte and hand over everything written (and not drained)
+    // so far; the writer starts over empty.
+    std::vector<char> finish();
+
+  private:
+    std::vector<char> bytes_;
+    uint64_t drained_ = 0; // Bytes handed over by drain()
+    uint64_t acc_ = 0;     // Bits not yet in bytes_, first one lowest
+    unsigned count_ = 0;   // Number of bits in acc_ (always < 64)
+
+    void flushWord();
+};
+
+class BitReader {
+  public:
+    // Read the bytes [begin, end), which must outlive the reader.
+    BitReader(const char* begin, const char* end)
+        : BitReader(begin, 0, 8 * uint64_t(end - begin))
+    { }
+
+    // Read bits [first, last) of the bytes starting at data, counting from
+    // the least significant bit of data[0].
+    BitReader(const char* data, uint64_t first, uint64_t last);
+
+    // Largest number of bits peek() and read() can return at once.
+    static constexpr unsigned MAX_PEEK = 57;
+
+    // The next `count` bits (at most MAX_PEEK), first one lowest, without
+    // consuming them. Bits past the end of the input read as zeros.
+    uint64_t peek(unsigned count) const {
+        return count ? acc_ & (~uint64_t(0) >> (64 - count)) : 0;
+    }
+
+    // Consume `count` bits (at most MAX_PEEK, and no more than are left).
+    void skip(unsigned count) {
+        acc_ = count < 64 ? acc_ >> count : 0;
+        count_ -= count;
+        refill();
+    }
+
+    // Consume and return the next `count` bits (at most MAX_PEEK).
+    // Throws a runtime_error if fewer than `count` bits are left.
+    uint64_t read(unsigned count);
+
+    // Consume all the remaining bits.
+    void skipToEnd() {
+        next_ = end_;
+        acc_ = 0;
+        count_ = 0;
+    }
+
+    // Return a reader for the next `count` bits, and skip them here.
+    // Throws a runtime_error if fewer than `count` bits are left.
+    BitReader take(uint64_t count);
+
+    // Number of bits left to read.
+    uint64_t bitsLeft() const {
+        return count_ + 8 * uint64_t(end_ - next_) - (next_ == end_ ? 0 : tail_);
+    }
+
+    // Number of bits consumed, counted from the start of data (not from
+    // the first bit read).
+    uint64_t position() const { return 8 * uint64_t(end_ - data_) - tail_ - bitsLeft(); }
+
+    // Skip to the next byte boundary (or the end of the input).
+    void alignToByte() {
+        const unsigned padding = (8 - position() % 8) % 8;
+        skip(padding < bitsLeft() ? padding : bitsLeft());
+    }
+
+  private:
+    const uint8_t* data_;
+    const uint8_t* next_; // Next byte to load into acc_
+    const uint8_t* end_;
+    unsigned tail_;       // Unused bits at the top of the last byte
+    uint64_t acc_ = 0;    // Bits loaded but not consumed, next one lowest
+    unsigned count_ = 0;  // Number of bits in acc_
+
+    void refill() {
+        while (count_ <= 56 && next_ != end_) {
+            uint64_t byte = *next_++;
+            if (next_ == end_ && tail_) {
+                acc_ |= (byte & (0xFF >> tail_)) << count_;
+                count_ += 8 - tail_;
+            } else {
+                acc_ |= byte << count_;
+                count_ += 8;
+            }
+        }
+    }
+};
+
+// Unpack the bytes [begin, end) into a vector of bits.
+Huffman::encoding_t unpack_bits(const char* begin, const char* end);
+
+} // namespace
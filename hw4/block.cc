@@ -0,0 +1,224 @@
+/*
+ * Block coding: one static Huffman code per block.
+ */
+
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <stdexcept>
+#include <utility>
+
+#include "bitio.hh"
+#include "block.hh"
+#include "header.hh"
+#include "workers.hh"
+
+namespace huffman {
+    constexpr unsigned COUNT_BITS = 32;
+    constexpr unsigned OFFSET_BITS = 64;
+    constexpr unsigned STREAM_SIZE_BITS = 64;
+
+    static Huffman::config_t block_config(const Huffman::config_t& config) {
+        Huffman::config_t block;
+        block.update = Huffman::update_t::STATIC;
+        block.max_length = config.max_length;
+        block.tree = config.tree;
+        return block;
+    }
+
+    void encode_block(const Huffman::symbol_t* symbols, size_t count,
+                      const Huffman::config_t& config, BitWriter& out, unsigned streams) {
+        if (count > MAX_BLOCK_SIZE) {
+            throw std::runtime_error("block too large!");
+        }
+        if (streams < 1 || streams > MAX_STREAMS) {
+            throw std::runtime_error("invalid number of streams!");
+        }
+        Huffman::encoding_t header;
+        put_bits(header, count, COUNT_BITS);
+        if (count > 0) {
+            Huffman huff(block_config(config));
+            for (size_t i = 0; i < count; i++) {
+                huff.incFreq(symbols[i]);
+            }
+            huff.rebuild();
+            write_lengths(header, huff.codeLengths());
+
+            std::vector<BitWriter> writers(streams);
+            for (size_t i = 0; i < count; i++) {
+                huff.encode(symbols[i], writers[i % streams]);
+            }
+            for (size_t s = 0; s + 1 < streams; s++) {
+                put_bits(header, writers[s].bitCount(), STREAM_SIZE_BITS);
+            }
+            out.write(header);
+            for (const auto& stream : writers) {
+                out.append(stream);
+            }
+        } else {
+            out.write(header);
+        }
+        out.alignToByte();
+    }
+
+    void encode_blocks(WorkerPool& workers, const Huffman::config_t& config, unsigned streams,
+                       const std::function<block_input_t()>& next,
+                       const std::function<void(std::vector<char>, uint64_t)>& write) {
+        std::deque<std::pair<uint64_t, std::future<std::vector<char>>>> pending;
+        auto write_oldest = [&]() {
+            auto bytes = pending.front().second.get();
+            const auto count = pending.front().first;
+            pending.pop_front();
+            write(std::move(bytes), count);
+        };
+        for (block_input_t input; (input = next()).size; ) {
+            const auto count = input.size;
+            pending.emplace_back(count, workers.submit([input = std::move(input), &config, streams]() {
+                BitWriter block;
+                encode_block(input.data(), input.size, config, block, streams);
+                return block.finish();
+            }));
+            if (pending.size() > 2 * workers.size()) {
+                write_oldest();
+            }
+        }
+        while (!pending.empty()) {
+            write_oldest();
+        }
+    }
+
+    uint64_t block_header_size(BitReader in, unsigned streams) {
+        if (in.bitsLeft() < COUNT_BITS) {
+            return 0;
+        }
+        if (get_bits(in, COUNT_BITS) == 0) {
+            return COUNT_BITS;
+        }
+        const auto lengths = lengths_size(in, Huffman::NUM_VALUES);
+        if (!lengths) {
+            return 0;
+        }
+        return COUNT_BITS + lengths + uint64_t(streams - 1) * STREAM_SIZE_BITS;
+    }
+
+    block_header_t read_block_header(BitReader& in, unsigned streams) {
+        if (streams < 1 || streams > MAX_STREAMS) {
+            throw std::runtime_error("invalid number of streams!");
+        }
+        block_header_t header;
+        header.count = get_bits(in, COUNT_BITS);
+        if (header.count > 0) {
+            header.lengths = read_lengths(in, Huffman::NUM_VALUES);
+            header.stream_sizes.resize(streams - 1);
+            for (auto& size : header.stream_sizes) {
+                size = get_bits(in, STREAM_SIZE_BITS);
+            }
+        }
+        return header;
+    }
+
+    template <typename Out>
+    static size_t decode_block_into(BitReader& in, Out& out, unsigned streams) {
+        const auto header = read_block_header(in, streams);
+        const size_t count = header.count;
+        if (count > 0) {
+            /* Every code takes at least a bit, so a count the input can't
+             * hold is corrupt (and mustn't size anything). */
+            if (count > in.bitsLeft()) {
+                throw std::runtime_error("block is truncated!");
+            }
+            Huffman huff(block_config(Huffman::config_t()));
+            huff.setCodeLengths(header.lengths);
+
+            /* Give each stream its own reader; the last one runs up to the
+             * end of the input. */
+            std::vector<BitReader> readers;
+            readers.reserve(streams);
+            for (auto size : header.stream_sizes) {
+                if (size > in.bitsLeft()) {
+                    throw std::runtime_error("block is truncated!");
+                }
+                readers.push_back(in.take(size));
+            }
+            readers.push_back(in);
+
+            /* Take one symbol from each stream in turn. Blocks have no EOF
+             * code, so every code has to be there. */
+            out.reserve(out.size() + count);
+            Huffman::symbol_t symbol = 0;
+            for (size_t i = 0; i < count; ) {
+                for (unsigned s = 0; s < streams && i < count; s++, i++) {
+                    if (!huff.decode(readers[s], symbol)) {
+                        throw std::runtime_error("block is truncated!");
+                    }
+                    out.push_back(symbol);
+                }
+            }
+            in = readers.back();
+        }
+
+        in.alignToByte();
+        return count;
+    }
+
+    size_t decode_block(BitReader& in, std::string& out, unsigned streams) {
+        return decode_block_into(in, out, streams);
+    }
+
+    size_t decode_block(BitReader& in, std::vector<char>& out, unsigned streams) {
+        return decode_block_into(in, out, streams);
+    }
+
+    void write_block_index(Huffman::encoding_t& bits, const block_index_t& index,
+                           uint64_t index_offset) {
+        put_bits(bits, index.size(), COUNT_BITS);
+        for (const auto& entry : index) {
+            put_bits(bits, entry.offset, OFFSET_BITS);
+            put_bits(bits, entry.count, COUNT_BITS);
+        }
+        put_bits(bits, index_offset, OFFSET_BITS);
+    }
+
+    uint64_t block_index_size(BitReader in) {
+        if (in.bitsLeft() < COUNT_BITS) {
+            return 0;
+        }
+        const uint64_t blocks = get_bits(in, COUNT_BITS);
+        return COUNT_BITS + blocks * (OFFSET_BITS + COUNT_BITS) + OFFSET_BITS;
+    }
+
+    bool read_block_index(const char* begin, const char* end, block_index_t& index) {
+        index.clear();
+        const uint64_t size = 8 * uint64_t(end - begin);
+        if (size < COUNT_BITS + OFFSET_BITS) {
+            return false;
+        }
+
+        /* The last field tells where the index starts; it has to account
+         * for exactly the rest of the stream. */
+        BitReader last(begin, size - OFFSET_BITS, size);
+        const uint64_t index_offset = get_bits(last, OFFSET_BITS);
+        if (index_offset > (size - COUNT_BITS - OFFSET_BITS) / 8) {
+            return false;
+        }
+        BitReader in(begin, index_offset * 8, size);
+        const uint64_t blocks = get_bits(in, COUNT_BITS);
+        if (in.bitsLeft() != blocks * (OFFSET_BITS + COUNT_BITS) + OFFSET_BITS) {
+            return false;
+        }
+
+        /* Blocks come in order and all lie in front of the index. */
+        for (uint64_t i = 0; i < blocks; i++) {
+            const block_entry_t entry = { get_bits(in, OFFSET_BITS),
+                                          get_bits(in, COUNT_BITS) };
+            const uint64_t next = index.empty() ? 0 : index.back().offset + 1;
+            if (entry.offset < next || entry.offset >= index_offset) {
+                index.clear();
+                return false;
+            }
+            index.push_back(entry);
+        }
+        return true;
+    }
+
+} // namespace huffman
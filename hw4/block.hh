@@ -0,0 +1,114 @@
+/*
+ * block.hh: semi-static block coding. Each block of input gets its own
+ * static Huffman code, built from the block's histogram and stored as a
+ * table of code lengths in front of the block's codes (much like DEFLATE's
+ * dynamic blocks). Blocks start on byte boundaries and don't depend on each
+ * other, so they can be coded separately.
+ *
+ * A block is a 32-bit symbol count, the code lengths, then the codes,
+ * padded to a whole byte. A block with a count of zero ends the stream.
+ *
+ * A block can split its codes across several interleaved streams (as in
+ * huff0): symbol i goes to stream i % streams. The 64-bit sizes (in bits) of
+ * all but the last stream follow the code lengths, then the streams one after
+ * the other. Each stream has its own cursor, so a decoder can keep one
+ * independent chain of lookups going per stream instead of one long chain.
+ *
+ * The end marker is followed by an index of the blocks, so a decoder can
+ * find every block without decoding the ones before it: a 32-bit block
+ * count, then each block's 64-bit byte offset in the stream and 32-bit
+ * symbol count, then the 64-bit byte offset of the index itself, which
+ * ends the stream. Decoders that read blocks in order never get that far.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "huffman.hh"
+
+namespace huffman {
+
+class WorkerPool;
+
+// Largest number of symbols a block can hold.
+constexpr uint64_t MAX_BLOCK_SIZE = 0xFFFFFFFF;
+// Most interleaved streams a block can have.
+constexpr unsigned MAX_STREAMS = 16;
+
+// Append a block holding symbols[0..count) to out, which must be at a byte
+// boundary. It's coded with a static code built with config's length limit,
+// in `streams` interleaved streams. An empty block is the end marker.
+void encode_block(const Huffman::symbol_t* symbols, size_t count,
+                  const Huffman::config_t& config, BitWriter& out, unsigned streams = 1);
+
+// A block's worth of input: either a view of symbols that outlive its
+// coding, or its own copy of them.
+struct block_input_t {
+    std::string bytes;
+    const char* view = nullptr;
+    size_t size = 0;
+
+    const Huffman::symbol_t* data() const {
+        return reinterpret_cast<const Huffman::symbol_t*>(view ? view : bytes.data());
+    }
+};
+
+// Code the blocks next() returns, up to the first empty one, in `streams`
+// interleaved streams on workers, and pass each block's bytes and symbol count to write() in input order.
+// A couple of blocks per worker are coded ahead of write(), so the output
+// doesn't depend on the number of workers.
+// Rethrows whatever coding a block, next() or write() throws.
+void encode_blocks(WorkerPool& workers, const Huffman::config_t& config, unsigned streams,
+                   const std::function<block_input_t()>& next,
+                   const std::function<void(std::vector<char> bytes, uint64_t count)>& write);
+
+// The start of a block: everything in front of its codes.
+struct block_header_t {
+    uint64_t count;                     // Zero for the end marker
+    std::vector<unsigned> lengths;      // The block's code lengths
+    std::vector<uint64_t> stream_sizes; // In bits, all streams but the last
+};
+
+// Number of bits the start of the block at in's position takes, or 0 if in
+// holds too little of it to tell.
+uint64_t block_header_size(BitReader in, unsigned streams);
+
+// Read the start of the block at in's position (a byte boundary), which was
+// coded in `streams` interleaved streams, and move in past it.
+// Throws a runtime_error if it's truncated or invalid.
+block_header_t read_block_header(BitReader& in, unsigned streams);
+
+// Decode the block at in's position (a byte boundary), which was coded in
+// `streams` interleaved streams, appending its symbols to out and moving in
+// past the block. Returns the number of symbols decoded: zero means in was
+// at the end marker.
+// Throws a runtime_error if the block is truncated or invalid.
+size_t decode_block(BitReader& in, std::string& out, unsigned streams = 1);
+size_t decode_block(BitReader& in, std::vector<char>& out, unsigned streams = 1);
+
+// Where a block starts in the stream (in bytes) and how many symbols it holds.
+struct block_entry_t {
+    uint64_t offset;
+    uint64_t count;
+};
+using block_index_t = std::vector<block_entry_t>;
+
+// Append the index of a stream's blocks to bits. index_offset is the byte
+// offset in the stream where the index starts (just past the end marker).
+void write_block_index(Huffman::encoding_t& bits, const block_index_t& index,
+                       uint64_t index_offset);
+
+// Number of bits the index at in's position takes, or 0 if in holds too
+// little of it to tell.
+uint64_t block_index_size(BitReader in);
+
+// Read the index at the end of the stream in bytes [begin, end) into index.
+// Returns false (leaving index empty) if the stream doesn't end with a valid
+// index.
+bool read_block_index(const char* begin, const char* end, block_index_t& index);
+
+} // namespace
@@ -0,0 +1,70 @@
+/*
+ * CodeBook: canonical code assignment.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "codebook.hh"
+
+namespace huffman {
+
+    void CodeBook::assign(const std::vector<unsigned>& lengths) {
+        std::fill(std::begin(count_), std::end(count_), 0);
+        for (auto length : lengths) {
+            if (length > MAX_LENGTH) {
+                throw std::runtime_error("code too long!");
+            }
+            count_[length]++;
+        }
+        count_[0] = 0;
+
+        /* Codes of each length follow on from the last code of the previous
+         * length (shifted left one bit). Running past 2^length means the
+         * lengths are oversubscribed. */
+        uint64_t next[MAX_LENGTH + 1] = {};
+        unsigned offset = 0;
+        for (unsigned length = 1; length <= MAX_LENGTH; length++) {
+            const uint64_t code = (first_[length - 1] + count_[length - 1]) << 1;
+            if (code + count_[length] > (uint64_t(1) << length)) {
+                throw std::runtime_error("code lengths don't form a prefix code!");
+            }
+            first_[length] = next[length] = code;
+            offset_[length] = offset;
+            offset += count_[length];
+        }
+
+        /* Hand out the codes in value order within each length, storing
+         * them bit-reversed so the first bit ends up least significant. */
+        codes_.assign(lengths.size(), { 0, 0 });
+        sorted_.resize(offset);
+        unsigned placed[MAX_LENGTH + 1] = {};
+        for (value_t value = 0; value < lengths.size(); value++) {
+            const auto length = lengths[value];
+            if (length == 0) {
+                continue;
+            }
+            const auto code = next[length]++;
+            uint64_t reversed = 0;
+            for (unsigned bit = 0; bit < length; bit++) {
+                reversed |= ((code >> (length - 1 - bit)) & 1) << bit;
+            }
+            codes_[value] = { reversed, length };
+            sorted_[offset_[length] + placed[length]++] = value;
+        }
+
+        /* A short code fills every table slot whose low bits match it,
+         * whatever comes after it in the window. */
+        table_.assign(1u << TABLE_BITS, { 0, 0 });
+        for (value_t value = 0; value < codes_.size(); value++) {
+            const auto& code = codes_[value];
+            if (code.length == 0 || code.length > TABLE_BITS) {
+                continue;
+            }
+            for (auto slot = code.bits; slot < table_.size(); slot += uint64_t(1) << code.length) {
+                table_[slot] = { static_cast<uint16_t>(value), static_cast<uint8_t>(code.length) };
+            }
+        }
+    }
+
+} // namespace huffman
@@ -0,0 +1,79 @@
+/*
+ * codebook.hh: canonical Huffman codes for a set of code lengths.
+ * Given only how long each value's code is, canonical codes are assigned in
+ * order of (length, value), so a code table can be rebuilt from the lengths
+ * alone and encoding a value is a single array lookup. Decoding looks up
+ * the next TABLE_BITS input bits in a table, which resolves every code that
+ * short in one step; only longer codes fall back to a bit-by-bit search.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace huffman {
+
+class CodeBook {
+  public:
+    using value_t = unsigned;
+
+    // A code packed into an integer. The first bit of the code is the least
+    // significant one, so codes can be appended to a bit stream LSB-first.
+    struct code_t {
+        uint64_t bits;
+        unsigned length;
+    };
+
+    // Longest code a CodeBook handles (so 2^length still fits in 64 bits).
+    static constexpr unsigned MAX_LENGTH = 63;
+
+    // How many bits of input the decode table looks at.
+    static constexpr unsigned TABLE_BITS = 10;
+
+    // What the decode table knows about a window of input bits.
+    struct entry_t {
+        uint16_t value;
+        uint8_t length; // Zero if the window starts with a longer code
+    };
+
+    // Assign canonical codes to values 0..lengths.size()-1. A length of zero
+    // means the value has no code.
+    // Throws a runtime_error if a length exceeds MAX_LENGTH or the lengths
+    // can't form a prefix code.
+    void assign(const std::vector<unsigned>& lengths);
+
+    const code_t& code(value_t value) const { return codes_[value]; }
+
+    // Heap memory held by the tables, in bytes.
+    size_t memoryUsage() const {
+        return codes_.capacity() * sizeof(code_t) + table_.capacity() * sizeof(entry_t) +
+            sorted_.capacity() * sizeof(value_t);
+    }
+
+    // Look up the code starting the next TABLE_BITS bits of input (first
+    // bit in the LSB, missing bits past the end of input as zeros).
+    const entry_t& peek(uint32_t window) const { return table_[window]; }
+
+    // Is the number formed by the first `length` bits of the input (first
+    // bit most significant) a complete code? If so, store its value.
+    bool lookup(unsigned length, uint64_t prefix, value_t& value) const {
+        const auto index = prefix - first_[length];
+        if (prefix < first_[length] || index >= count_[length]) {
+            return false;
+        }
+        value = sorted_[offset_[length] + index];
+        return true;
+    }
+
+  private:
+    std::vector<code_t> codes_;
+    std::vector<entry_t> table_;           // Indexed by TABLE_BITS of input
+    std::vector<value_t> sorted_;          // Values in canonical order
+    uint64_t first_[MAX_LENGTH + 1] = {};  // First code of each length
+    unsigned count_[MAX_LENGTH + 1] = {};  // Number of codes of each length
+    unsigned offset_[MAX_LENGTH + 1] = {}; // Where each length starts in sorted_
+};
+
+} // namespace
@@ -8,37 +8,124 @@
 
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <limits>
 #include <string>
+#include <vector>
+#include <unistd.h>
 
+#include "bitio.hh"
+#include "codebook.hh"
+#include "header.hh"
 #include "huffman.hh"
+#include "options.hh"
 
 using namespace std;
+using namespace huffman;
+
+// Print bits [from, to) of packed bytes as "0"s and "1"s.
+void print_bits(const vector<char>& bytes, uint64_t from, uint64_t to)
+{
+  for (auto i = from; i < to; i++) {
+      cout << ((bytes[i / 8] >> (i % 8)) & 1);
+  }
+}
+
+void usage(const char* prog)
+{
+  cerr << "Usage: " << prog << " [-v] [-p interval | -g cap | -s] [-l length] < input > output\n"
+       << "  -v           print each symbol next to its encoding\n"
+       << "  -p interval  rebuild the code every `interval` symbols\n"
+       << "  -g cap       rebuild after 1, 2, 4... symbols, at most `cap` apart\n"
+       << "  -s           build one static code for the whole input (two passes)\n"
+       << "  -l length    with -p, -g or -s, never assign codes longer than `length`\n"
+       << "By default the code is updated adaptively after every symbol.\n";
+}
 
 int main(int argc, char** argv)
 {
-  const bool verbose = argc > 1 && string(argv[1]) == "-v";
-  huffman::Huffman huff;
-
-  // Read in all of stdin, line by line.
-  // Iterate over input characters, output their encoding
-  // and update their frequency:
-  for (string line; getline(cin, line); ) {
-      for (auto c : line + '\n') {
-          if (verbose)  cout << c << "\t";
-          for (auto bit : huff.encode(c)) {
-              cout << bit;
+  bool verbose = false;
+  Huffman::config_t config;
+  const auto max_interval = numeric_limits<uint32_t>::max();
+  for (int opt; (opt = getopt(argc, argv, "vp:g:sl:")) != -1; ) {
+      switch (opt) {
+        case 'v':
+          verbose = true;
+          break;
+        case 'p':
+          config.update = Huffman::update_t::REBUILD;
+          config.interval = parse_count(optarg, "interval", max_interval);
+          break;
+        case 'g':
+          config.update = Huffman::update_t::GEOMETRIC;
+          config.interval = parse_count(optarg, "cap", max_interval);
+          break;
+        case 's':
+          config.update = Huffman::update_t::STATIC;
+          break;
+        case 'l':
+          config.max_length = parse_count(optarg, "maximum code length", CodeBook::MAX_LENGTH);
+          if (config.max_length < Huffman::MIN_LENGTH) {
+              cerr << "Maximum code length must be at least " << Huffman::MIN_LENGTH << "\n";
+              return 1;
           }
+          break;
+        default:
+          usage(argv[0]);
+          return 1;
+      }
+  }
+  Huffman huff(config);
+
+  // Read in all of stdin, as is (it may not end with a newline, or may
+  // not be text at all):
+  const string input{ istreambuf_iterator<char>(cin), istreambuf_iterator<char>() };
+
+  // Start with the header, so the decoder can build the same model.
+  // A static code is built from the whole input up front, and its code
+  // lengths go into the header too:
+  Huffman::encoding_t header;
+  write_header(header, config);
+  if (config.update == Huffman::update_t::STATIC) {
+      for (auto c : input) {
           huff.incFreq(c);
-          if (verbose) cout << "\n";
       }
+      huff.rebuild();
+      write_lengths(header, huff.codeLengths());
   }
+  BitWriter out;
+  out.write(header);
 
-  // Finally, output end-of-file code
-  if (verbose) cout << "EOF\t";
-  for (auto bit : huff.eofCode()) {
-      cout << bit;
+  // Iterate over input characters, encode them
+  // and update their frequency. With -v, remember where each code ends:
+  vector<uint64_t> ends;
+  if (verbose) ends.push_back(out.bitCount());
+  for (auto c : input) {
+      huff.encode(c, out);
+      huff.incFreq(c);
+      if (verbose) ends.push_back(out.bitCount());
+  }
+
+  // Finally, the end-of-file code
+  huff.eofCode(out);
+  const auto total = out.bitCount();
+  const auto bits = out.finish();
+
+  if (!verbose) {
+      print_bits(bits, 0, total);
+      return 0;
+  }
+  cout << "HEADER\t";
+  print_bits(bits, 0, ends[0]);
+  cout << "\n";
+  for (size_t i = 0; i < input.size(); i++) {
+      cout << input[i] << "\t";
+      print_bits(bits, ends[i], ends[i + 1]);
+      cout << "\n";
   }
-  if (verbose) cout << "\n";
+  cout << "EOF\t";
+  print_bits(bits, ends.back(), total);
+  cout << "\n";
 
   return 0;
 }
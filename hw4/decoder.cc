@@ -0,0 +1,296 @@
+/*
+ * StreamDecoder: decode a stream as it arrives, a piece at a time.
+ *
+ * Everything not decoded yet stays in buffer_, and each state waits until
+ * the buffer holds all of the next thing it needs. Headers and tables say
+ * how long they are up front. Codes don't, so a symbol is decoded from
+ * whatever bits there are; if that runs out before the code is complete,
+ * it's tried again with more input.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "bitio.hh"
+#include "block.hh"
+#include "decoder.hh"
+#include "frame.hh"
+#include "header.hh"
+
+namespace huffman {
+
+    StreamDecoder::StreamDecoder() = default;
+    StreamDecoder::~StreamDecoder() = default;
+
+    bool StreamDecoder::push(const char* data, size_t size, std::string& out) {
+        if (state_ != state_t::DONE) {
+            buffer_.append(data, size);
+            run(out);
+            compact();
+        }
+        return done();
+    }
+
+    void StreamDecoder::finish(std::string& out) {
+        final_ = true;
+        run(out);
+    }
+
+    void StreamDecoder::run(std::string& out) {
+        const uint64_t end = 8 * uint64_t(buffer_.size());
+        for (;;) {
+            BitReader in(buffer_.data(), pos_, end);
+            switch (state_) {
+              case state_t::FRAME: {
+                  if (wait(8 * FRAME_HEADER_SIZE, "frame header is truncated!")) {
+                      return;
+                  }
+                  frame_ = read_frame_header(buffer_.data() + pos_ / 8, FRAME_HEADER_SIZE);
+                  pos_ += 8 * FRAME_HEADER_SIZE;
+                  state_ = state_t::HEADER;
+                  break;
+              }
+
+              case state_t::HEADER: {
+                  if (wait(header_size(in), "stream header is truncated!")) {
+                      return;
+                  }
+                  config_ = read_header(in, &layout_);
+                  if (layout_.blocks != frame_.blocks) {
+                      throw std::runtime_error("stream header doesn't match its frame!");
+                  }
+                  pos_ = in.position();
+                  if (layout_.blocks) {
+                      state_ = state_t::BLOCK;
+                  } else {
+                      huff_.reset(new Huffman(config_));
+                      eofStale_ = true;
+                      state_ = config_.update == Huffman::update_t::STATIC
+                          ? state_t::LENGTHS : state_t::CODES;
+                  }
+                  break;
+              }
+
+              case state_t::LENGTHS: {
+                  if (wait(lengths_size(in, Huffman::NUM_VALUES),
+                           "code length table is truncated!")) {
+                      return;
+                  }
+                  huff_->setCodeLengths(read_lengths(in, Huffman::NUM_VALUES));
+                  eofStale_ = true;
+                  pos_ = in.position();
+                  state_ = state_t::CODES;
+                  break;
+              }
+
+              case state_t::CODES: {
+                  /* With the length in the frame header there's no EOF
+                   * code: the stream ends after that many symbols. One
+                   * reader goes through all the input at hand. */
+                  Huffman::symbol_t symbol;
+                  while (!frame_.sized || decoded_ < frame_.length) {
+                      const auto step = decodeSymbol(in, symbol, !frame_.sized);
+                      if (step == step_t::END) {
+                          break;
+                      }
+                      if (step == step_t::MORE) {
+                          pos_ = in.position();
+                          if (final_) {
+                              throw std::runtime_error("stream is truncated!");
+                          }
+                          return;
+                      }
+                      out.push_back(symbol);
+                      decoded_++;
+                      huff_->incFreq(symbol);
+                      eofStale_ = true;
+                  }
+                  pos_ = (in.position() + 7) / 8 * 8;
+                  state_ = state_t::END;
+                  break;
+              }
+
+              case state_t::BLOCK: {
+                  if (wait(block_header_size(in, layout_.streams), "block stream is truncated!")) {
+                      return;
+                  }
+                  const auto header = read_block_header(in, layout_.streams);
+                  pos_ = in.position();
+                  if (header.count == 0) {
+                      state_ = state_t::INDEX;
+                      break;
+                  }
+                  Huffman::config_t config;
+                  config.update = Huffman::update_t::STATIC;
+                  huff_.reset(new Huffman(config));
+                  huff_->setCodeLengths(header.lengths);
+                  eofStale_ = true;
+                  left_ = header.count;
+                  next_ = 0;
+                  sizes_ = header.stream_sizes;
+                  state_ = state_t::STREAMS;
+                  break;
+              }
+
+              case state_t::STREAMS: {
+                  /* All streams but the last have to be there in full
+                   * before the first symbol can come out. */
+                  cursors_.assign(1, pos_);
+                  ends_.clear();
+                  uint64_t left = available();
+                  for (auto size : sizes_) {
+                      if (size > left) {
+                          if (final_) {
+                              throw std::runtime_error("block is truncated!");
+                          }
+                          return;
+                      }
+                      left -= size;
+                      ends_.push_back(cursors_.back() + size);
+                      cursors_.push_back(ends_.back());
+                  }
+                  state_ = state_t::SYMBOLS;
+                  break;
+              }
+
+              case state_t::SYMBOLS: {
+                  /* Take one symbol from each stream in turn, with a reader
+                   * for each. Only the last stream can still be waiting for
+                   * input. */
+                  const auto streams = cursors_.size();
+                  readers_.clear();
+                  for (size_t stream = 0; stream < streams; stream++) {
+                      readers_.emplace_back(buffer_.data(), cursors_[stream],
+                                            stream + 1 == streams ? end : ends_[stream]);
+                  }
+                  Huffman::symbol_t symbol;
+                  while (left_) {
+                      const bool last = next_ + 1 == streams;
+                      const auto step = decodeSymbol(readers_[next_], symbol, true);
+                      if (step == step_t::END) {
+                          throw std::runtime_error("EOF code in a block!");
+                      }
+                      if (step == step_t::MORE) {
+                          if (!last || final_) {
+                              throw std::runtime_error("block is truncated!");
+                          }
+                          for (size_t stream = 0; stream < streams; stream++) {
+                              cursors_[stream] = readers_[stream].position();
+                          }
+                          return;
+                      }
+                      out.push_back(symbol);
+                      decoded_++;
+                      left_--;
+                      next_ = (next_ + 1) % streams;
+                  }
+                  cursors_.back() = readers_.back().position();
+                  pos_ = (cursors_.back() + 7) / 8 * 8;
+                  state_ = state_t::BLOCK;
+                  break;
+              }
+
+              case state_t::INDEX: {
+                  const auto size = block_index_size(in);
+                  if (wait(size, "block index is truncated!")) {
+                      return;
+                  }
+                  pos_ += size;
+                  state_ = state_t::END;
+                  break;
+              }
+
+              case state_t::END: {
+                  if (wait(8 * FRAME_END_SIZE, "stream has no end marker!")) {
+                      return;
+                  }
+                  const auto length = read_frame_end(buffer_.data() + pos_ / 8, FRAME_END_SIZE);
+                  if (length != decoded_ || (frame_.sized && frame_.length != decoded_)) {
+                      throw std::runtime_error("stream length doesn't match its frame!");
+                  }
+                  pos_ += 8 * FRAME_END_SIZE;
+                  state_ = state_t::DONE;
+                  break;
+              }
+
+              case state_t::DONE:
+                  return;
+            }
+        }
+    }
+
+    bool StreamDecoder::wait(uint64_t size, const char* what) const {
+        /* A size of 0 means there's too little input to tell yet. */
+        if (size && available() >= size) {
+            return false;
+        }
+        if (final_) {
+            throw std::runtime_error(what);
+        }
+        return true;
+    }
+
+    StreamDecoder::step_t StreamDecoder::decodeSymbol(BitReader& in, Huffman::symbol_t& symbol,
+                                                      bool eof) {
+        /* A failed decode may have consumed the input: try again from
+         * where it started once more comes in. */
+        const auto start = in;
+        if (huff_->decode(in, symbol)) {
+            return step_t::SYMBOL;
+        }
+        in = start;
+        if (eof && atEof(in)) {
+            return step_t::END;
+        }
+        return step_t::MORE;
+    }
+
+    bool StreamDecoder::atEof(BitReader& in) {
+        /* Codes are prefix-free, so the bits at in are the EOF code
+         * exactly if they start with it. The code only changes with the
+         * model, so it's kept until then. */
+        if (eofStale_) {
+            BitWriter writer;
+            huff_->eofCode(writer);
+            eofLength_ = writer.bitCount();
+            eof_ = writer.finish();
+            eofStale_ = false;
+        }
+        if (in.bitsLeft() < eofLength_) {
+            return false;
+        }
+        BitReader expected(eof_.data(), 0, eofLength_);
+        auto probe = in;
+        while (expected.bitsLeft()) {
+            const auto count = unsigned(std::min<uint64_t>(expected.bitsLeft(),
+                                                           BitReader::MAX_PEEK));
+            if (expected.read(count) != probe.read(count)) {
+                return false;
+            }
+        }
+        in = probe;
+        return true;
+    }
+
+    void StreamDecoder::compact() {
+        /* Drop the bytes that have been decoded, once they make up most of
+         * the buffer, so erasing stays cheap overall. */
+        uint64_t keep = pos_;
+        if (state_ == state_t::SYMBOLS) {
+            keep = *std::min_element(cursors_.begin(), cursors_.end());
+        }
+        const uint64_t drop = std::min<uint64_t>(keep / 8, buffer_.size());
+        if (drop == 0 || drop < buffer_.size() / 2) {
+            return;
+        }
+        buffer_.erase(0, drop);
+        pos_ -= std::min(pos_, 8 * drop);
+        for (auto& cursor : cursors_) {
+            cursor -= std::min(cursor, 8 * drop);
+        }
+        for (auto& end : ends_) {
+            end -= 8 * drop;
+        }
+    }
+
+} // namespace huffman
@@ -0,0 +1,93 @@
+/*
+ * decoder.hh: a push-style decoder for bitcompress streams (in their frame,
+ * see frame.hh). Compressed input is fed in whatever pieces it arrives in
+ * (like zlib's inflate), and every symbol whose code is complete comes out
+ * right away. Only the bits of an unfinished code (or header) are kept
+ * between pieces, except that a block with interleaved streams is held
+ * until all but its last stream have arrived.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bitio.hh"
+#include "frame.hh"
+#include "header.hh"
+#include "huffman.hh"
+
+namespace huffman {
+
+class StreamDecoder {
+  public:
+    StreamDecoder();
+    ~StreamDecoder();
+
+    // Decode the next `size` bytes of the stream, appending the symbols to
+    // out. Returns true once the stream is complete; anything pushed after
+    // that is ignored.
+    // Throws a runtime_error if the stream is invalid.
+    bool push(const char* data, size_t size, std::string& out);
+
+    // There's no more input: decode whatever is left, appending it to out.
+    // Throws a runtime_error if the stream is invalid or cut short.
+    void finish(std::string& out);
+
+    // Has the stream ended (with its frame's end marker)?
+    bool done() const { return state_ == state_t::DONE; }
+
+    // The stream's frame header, once it has been read.
+    const frame_t& frame() const { return frame_; }
+
+  private:
+    enum class state_t {
+        FRAME,   // Waiting for the frame header
+        HEADER,  // Waiting for the stream header
+        LENGTHS, // Waiting for a static code's lengths
+        CODES,   // Decoding a single stream of codes
+        BLOCK,   // Waiting for the start of the next block
+        STREAMS, // Waiting for a block's streams (all but the last)
+        SYMBOLS, // Decoding a block's symbols
+        INDEX,   // Waiting for the block index (which is skipped)
+        END,     // Waiting for the frame's end marker
+        DONE,
+    };
+
+    // What a single symbol decode came to.
+    enum class step_t { SYMBOL, END, MORE };
+
+    state_t state_ = state_t::FRAME;
+    bool final_ = false;       // Has finish() been called?
+    std::string buffer_;       // Undecoded input
+    uint64_t pos_ = 0;         // Next bit to decode in buffer_
+    uint64_t decoded_ = 0;     // Number of symbols decoded so far
+    frame_t frame_;
+    Huffman::config_t config_;
+    block_config_t layout_;
+    std::unique_ptr<Huffman> huff_;
+
+    // The block being decoded:
+    uint64_t left_ = 0;              // Symbols still to come
+    uint64_t next_ = 0;              // Stream the next symbol comes from
+    std::vector<uint64_t> sizes_;    // Sizes of all streams but the last
+    std::vector<uint64_t> cursors_;  // Next bit of each stream in buffer_
+    std::vector<uint64_t> ends_;     // End of each stream but the last
+    std::vector<BitReader> readers_; // Each stream's reader, while decoding
+
+    // The current model's EOF code, rebuilt when the model changes:
+    std::vector<char> eof_;
+    uint64_t eofLength_ = 0;
+    bool eofStale_ = true;
+
+    uint64_t available() const { return 8 * uint64_t(buffer_.size()) - pos_; }
+    void run(std::string& out);
+    bool wait(uint64_t size, const char* what) const;
+    step_t decodeSymbol(BitReader& in, Huffman::symbol_t& symbol, bool eof);
+    bool atEof(BitReader& in);
+    void compact();
+};
+
+} // namespace
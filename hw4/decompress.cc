@@ -11,6 +11,7 @@
 #include <string>
 #include <cassert>
 
+#include "header.hh"
 #include "huffman.hh"
 
 using namespace std;
@@ -18,8 +19,6 @@ using namespace huffman;
 
 int main(int, char**)
 {
-  huffman::Huffman huff;
-
   // Assuming input is a single line, read it all into a string:
   string line;
   getline(cin, line);
@@ -31,6 +30,14 @@ int main(int, char**)
   auto b = input.cbegin();
   auto e = input.cend();
 
+  // The header tells us how the encoder's model was set up, and static
+  // codes come with their code lengths:
+  const auto config = read_header(b, e);
+  Huffman huff(config);
+  if (config.update == Huffman::update_t::STATIC) {
+      huff.setCodeLengths(read_lengths(b, e, Huffman::NUM_VALUES));
+  }
+
   // Iterate over input bits, output their decoding
   // and update their frequency:
   while (b != e) {
@@ -0,0 +1,74 @@
+/*
+ * Frame headers and end markers: plain bytes, so they're read and written
+ * without going through the bit I/O.
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include "frame.hh"
+
+namespace huffman {
+    static const char MAGIC[4] = { 'H', 'u', 'f', '\x1A' };
+    constexpr unsigned FLAG_BLOCKS = 1;
+    constexpr unsigned FLAG_SIZED = 2;
+
+    static void put_u64(std::vector<char>& out, uint64_t value) {
+        for (unsigned i = 0; i < 8; i++) {
+            out.push_back(char(value >> (8 * i)));
+        }
+    }
+
+    static uint64_t get_u64(const char* data) {
+        uint64_t value = 0;
+        for (unsigned i = 0; i < 8; i++) {
+            value |= uint64_t(uint8_t(data[i])) << (8 * i);
+        }
+        return value;
+    }
+
+    void write_frame_header(std::vector<char>& out, const frame_t& frame) {
+        out.insert(out.end(), MAGIC, MAGIC + sizeof(MAGIC));
+        out.push_back(char(FRAME_VERSION));
+        out.push_back(char((frame.blocks ? FLAG_BLOCKS : 0) | (frame.sized ? FLAG_SIZED : 0)));
+        put_u64(out, frame.sized ? frame.length : 0);
+    }
+
+    frame_t read_frame_header(const char* data, size_t size) {
+        if (size < FRAME_HEADER_SIZE) {
+            throw std::runtime_error("frame header is truncated!");
+        }
+        if (!std::equal(MAGIC, MAGIC + sizeof(MAGIC), data)) {
+            throw std::runtime_error("not a compressed stream!");
+        }
+        if (uint8_t(data[4]) != FRAME_VERSION) {
+            throw std::runtime_error("unknown stream format version!");
+        }
+        const unsigned flags = uint8_t(data[5]);
+        if (flags & ~(FLAG_BLOCKS | FLAG_SIZED)) {
+            throw std::runtime_error("unknown flags in frame header!");
+        }
+        frame_t frame;
+        frame.blocks = flags & FLAG_BLOCKS;
+        frame.sized = flags & FLAG_SIZED;
+        frame.length = get_u64(data + 6);
+        return frame;
+    }
+
+    void write_frame_end(std::vector<char>& out, uint64_t length) {
+        put_u64(out, length);
+        out.insert(out.end(), MAGIC, MAGIC + sizeof(MAGIC));
+        std::reverse(out.end() - sizeof(MAGIC), out.end());
+    }
+
+    uint64_t read_frame_end(const char* data, size_t size) {
+        if (size != FRAME_END_SIZE
+                || !std::equal(MAGIC, MAGIC + sizeof(MAGIC),
+                               std::reverse_iterator<const char*>(data + size))) {
+            throw std::runtime_error("stream has no end marker!");
+        }
+        return get_u64(data);
+    }
+
+} // namespace huffman
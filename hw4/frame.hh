@@ -0,0 +1,52 @@
+/*
+ * frame.hh: the container every bitcompress stream comes in. A fixed-size
+ * frame header goes in front of the stream (see header.hh), and an end
+ * marker after it, so a decoder can tell a compressed file from anything
+ * else and notice when one has been cut short.
+ *
+ * The frame header is a 4-byte magic number, a version byte, a byte of
+ * flags and the 64-bit length of the original input. The end marker is the
+ * 64-bit length again, followed by the magic number reversed. Lengths are
+ * stored least significant byte first.
+ *
+ * The encoder doesn't always know the length up front (say, reading from a
+ * pipe), so the frame header only holds it when the SIZED flag is set. A
+ * single stream of codes with a known length has no EOF code: the decoder
+ * simply stops after that many symbols. The end marker always holds it.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace huffman {
+
+constexpr unsigned FRAME_VERSION = 1;
+constexpr size_t FRAME_HEADER_SIZE = 14;
+constexpr size_t FRAME_END_SIZE = 12;
+
+struct frame_t {
+    bool blocks = false;  // Independent blocks follow (see block.hh)
+    bool sized = false;   // length holds the length of the original input
+    uint64_t length = 0;
+};
+
+// Append a frame header describing frame to out.
+void write_frame_header(std::vector<char>& out, const frame_t& frame);
+
+// Parse the frame header at the start of the `size` bytes at data.
+// Throws a runtime_error if it's truncated, isn't a frame header, or comes
+// from an unknown version.
+frame_t read_frame_header(const char* data, size_t size);
+
+// Append an end marker for an input of `length` bytes to out.
+void write_frame_end(std::vector<char>& out, uint64_t length);
+
+// Parse the end marker in the `size` bytes at data (exactly FRAME_END_SIZE)
+// and return the length it holds.
+// Throws a runtime_error if it isn't a valid end marker.
+uint64_t read_frame_end(const char* data, size_t size);
+
+} // namespace
@@ -0,0 +1,202 @@
+/*
+ * Stream header: a flag telling whether blocks follow, a 2-bit update mode,
+ * followed by the 32-bit rebuild interval and the 6-bit maximum code length
+ * (0 for none) for the modes that rebuild the tree. Block streams add the
+ * 4-bit number of interleaved streams per block (less one), and pad the
+ * header to a whole byte.
+ *
+ * A table of code lengths (used by static codes) starts with a 3-bit width
+ * w, followed by each length in w bits: just enough for the longest one.
+ */
+
+#include <algorithm>
+
+#include <stdexcept>
+
+#include "bitio.hh"
+#include "block.hh"
+#include "header.hh"
+
+namespace huffman {
+    constexpr unsigned MODE_BITS = 2;
+    constexpr unsigned INTERVAL_BITS = 32;
+    constexpr unsigned LENGTH_BITS = 6;
+    constexpr unsigned WIDTH_BITS = 3;
+    constexpr unsigned STREAMS_BITS = 4;
+
+    void put_bits(Huffman::encoding_t& bits, uint64_t value, unsigned count) {
+        while (count--) {
+            bits.push_back(Huffman::bit_t((value >> count) & 1));
+        }
+    }
+
+    uint64_t get_bits(Huffman::enc_iter_t& begin, const Huffman::enc_iter_t& end,
+                      unsigned count) {
+        uint64_t value = 0;
+        while (count--) {
+            if (begin == end) {
+                throw std::runtime_error("stream header is truncated!");
+            }
+            value = (value << 1) | (*begin++ == Huffman::ONE);
+        }
+        return value;
+    }
+
+    uint64_t get_bits(BitReader& in, unsigned count) {
+        if (count > in.bitsLeft()) {
+            throw std::runtime_error("stream header is truncated!");
+        }
+        /* Fields are stored most significant bit first, the reverse of the
+         * order BitReader hands them out in. */
+        uint64_t value = 0;
+        while (count) {
+            const unsigned chunk = std::min(count, 32u);
+            const auto bits = in.read(chunk);
+            for (unsigned i = 0; i < chunk; i++) {
+                value = (value << 1) | ((bits >> i) & 1);
+            }
+            count -= chunk;
+        }
+        return value;
+    }
+
+    void write_header(Huffman::encoding_t& bits, const Huffman::config_t& config,
+                      const block_config_t& layout) {
+        const auto start = bits.size();
+        put_bits(bits, layout.blocks, 1);
+        put_bits(bits, static_cast<unsigned>(config.update), MODE_BITS);
+        if (config.update == Huffman::update_t::REBUILD ||
+                config.update == Huffman::update_t::GEOMETRIC) {
+            put_bits(bits, config.interval, INTERVAL_BITS);
+            put_bits(bits, config.max_length, LENGTH_BITS);
+        }
+        if (layout.blocks) {
+            if (layout.streams < 1 || layout.streams > MAX_STREAMS) {
+                throw std::runtime_error("invalid number of streams!");
+            }
+            put_bits(bits, layout.streams - 1, STREAMS_BITS);
+        }
+        while (layout.blocks && (bits.size() - start) % 8) {
+            bits.push_back(Huffman::ZERO);
+        }
+    }
+
+    /* The header parsers read from bit vectors as well as packed bytes;
+     * these give both the same interface. */
+    struct IterSource {
+        Huffman::enc_iter_t& begin;
+        const Huffman::enc_iter_t& end;
+        const Huffman::enc_iter_t start;
+
+        uint64_t get(unsigned count) { return get_bits(begin, end, count); }
+        uint64_t position() const { return begin - start; }
+    };
+
+    struct ReaderSource {
+        BitReader& in;
+        const uint64_t start;
+
+        uint64_t get(unsigned count) { return get_bits(in, count); }
+        uint64_t position() const { return in.position() - start; }
+    };
+
+    template <typename Source>
+    static Huffman::config_t parse_header(Source in, block_config_t* layout) {
+        Huffman::config_t config;
+        block_config_t found;
+        found.blocks = in.get(1);
+        if (found.blocks && !layout) {
+            throw std::runtime_error("unexpected block stream!");
+        }
+        const auto mode = in.get(MODE_BITS);
+        if (mode > static_cast<unsigned>(Huffman::update_t::STATIC)) {
+            throw std::runtime_error("unknown update mode in stream header!");
+        }
+        config.update = static_cast<Huffman::update_t>(mode);
+        if (config.update == Huffman::update_t::REBUILD ||
+                config.update == Huffman::update_t::GEOMETRIC) {
+            config.interval = in.get(INTERVAL_BITS);
+            if (config.interval == 0) {
+                throw std::runtime_error("invalid rebuild interval in stream header!");
+            }
+            config.max_length = in.get(LENGTH_BITS);
+            if (config.max_length != 0 && config.max_length < Huffman::MIN_LENGTH) {
+                throw std::runtime_error("invalid maximum code length in stream header!");
+            }
+        }
+        if (found.blocks) {
+            found.streams = in.get(STREAMS_BITS) + 1;
+            in.get((8 - in.position() % 8) % 8);
+        }
+        if (layout) {
+            *layout = found;
+        }
+        return config;
+    }
+
+    Huffman::config_t read_header(Huffman::enc_iter_t& begin,
+                                  const Huffman::enc_iter_t& end,
+                                  block_config_t* layout) {
+        return parse_header(IterSource{ begin, end, begin }, layout);
+    }
+
+    Huffman::config_t read_header(BitReader& in, block_config_t* layout) {
+        return parse_header(ReaderSource{ in, in.position() }, layout);
+    }
+
+    uint64_t header_size(BitReader in) {
+        if (in.bitsLeft() < 1 + MODE_BITS) {
+            return 0;
+        }
+        const bool blocks = get_bits(in, 1);
+        const auto mode = static_cast<Huffman::update_t>(get_bits(in, MODE_BITS));
+        uint64_t size = 1 + MODE_BITS;
+        if (mode == Huffman::update_t::REBUILD || mode == Huffman::update_t::GEOMETRIC) {
+            size += INTERVAL_BITS + LENGTH_BITS;
+        }
+        if (blocks) {
+            size = (size + STREAMS_BITS + 7) / 8 * 8;
+        }
+        return size;
+    }
+
+    void write_lengths(Huffman::encoding_t& bits, const std::vector<unsigned>& lengths) {
+        const unsigned longest = lengths.empty() ? 0
+            : *std::max_element(lengths.begin(), lengths.end());
+        unsigned width = 1;
+        while (longest >> width) {
+            width++;
+        }
+        put_bits(bits, width, WIDTH_BITS);
+        for (auto length : lengths) {
+            put_bits(bits, length, width);
+        }
+    }
+
+    std::vector<unsigned> read_lengths(Huffman::enc_iter_t& begin,
+                                       const Huffman::enc_iter_t& end, unsigned count) {
+        const unsigned width = get_bits(begin, end, WIDTH_BITS);
+        std::vector<unsigned> lengths(count);
+        for (auto& length : lengths) {
+            length = get_bits(begin, end, width);
+        }
+        return lengths;
+    }
+
+    std::vector<unsigned> read_lengths(BitReader& in, unsigned count) {
+        const unsigned width = get_bits(in, WIDTH_BITS);
+        std::vector<unsigned> lengths(count);
+        for (auto& length : lengths) {
+            length = get_bits(in, width);
+        }
+        return lengths;
+    }
+
+    uint64_t lengths_size(BitReader in, unsigned count) {
+        if (in.bitsLeft() < WIDTH_BITS) {
+            return 0;
+        }
+        return WIDTH_BITS + get_bits(in, WIDTH_BITS) * count;
+    }
+
+} // namespace huffman
@@ -0,0 +1,65 @@
+/*
+ * header.hh: the header at the start of every compressed stream, which
+ * tells the decoder how the encoder's Huffman model was configured.
+ */
+
+#pragma once
+
+#include "huffman.hh"
+
+namespace huffman {
+
+// Append the lowest `count` bits of value to bits, most significant first.
+void put_bits(Huffman::encoding_t& bits, uint64_t value, unsigned count);
+
+// Read `count` bits (most significant first) from [begin, end) or from in,
+// advancing past them.
+// Throws a runtime_error if there aren't enough bits.
+uint64_t get_bits(Huffman::enc_iter_t& begin, const Huffman::enc_iter_t& end,
+                  unsigned count);
+uint64_t get_bits(BitReader& in, unsigned count);
+
+// How the codes after a header are laid out: as a single stream, or as
+// independent blocks (see block.hh), each in a number of interleaved
+// streams. The Huffman model doesn't care; only the container does.
+struct block_config_t {
+    bool blocks = false;
+    unsigned streams = 1;  // Interleaved streams per block
+};
+
+// Append the header describing config and layout to bits. If
+// layout.blocks is set, the header is padded to a whole byte and
+// independent blocks follow instead of a single stream of codes.
+// Throws a runtime_error if the number of streams is invalid.
+void write_header(Huffman::encoding_t& bits, const Huffman::config_t& config,
+                  const block_config_t& layout = block_config_t());
+
+// Parse a header from the start of [begin, end) or from in, advancing past
+// it.
+// If layout isn't null, it's set to the layout that follows; otherwise a
+// header for blocks is invalid.
+// Throws a runtime_error if the header is truncated or invalid.
+Huffman::config_t read_header(Huffman::enc_iter_t& begin,
+                              const Huffman::enc_iter_t& end,
+                              block_config_t* layout = nullptr);
+Huffman::config_t read_header(BitReader& in, block_config_t* layout = nullptr);
+
+// Number of bits the header at in's position takes, or 0 if in holds too
+// little of it to tell.
+uint64_t header_size(BitReader in);
+
+// Append a table of code lengths to bits.
+void write_lengths(Huffman::encoding_t& bits, const std::vector<unsigned>& lengths);
+
+// Parse a table of `count` code lengths from the start of [begin, end) or
+// from in, advancing past it.
+// Throws a runtime_error if the table is truncated.
+std::vector<unsigned> read_lengths(Huffman::enc_iter_t& begin,
+                                   const Huffman::enc_iter_t& end, unsigned count);
+std::vector<unsigned> read_lengths(BitReader& in, unsigned count);
+
+// Number of bits a table of `count` code lengths at in's position takes, or
+// 0 if in holds too little of it to tell.
+uint64_t lengths_size(BitReader in, unsigned count);
+
+} // namespace
@@ -1,161 +1,531 @@
-#include <unordered_map>
-#include <queue>
+#include <algorithm>
+#include <utility>
 
+#include "adaptive.hh"
+#include "bitio.hh"
+#include "arraytree.hh"
+#include "codebook.hh"
+#include "packagemerge.hh"
 #include "ptrtree.hh"
 #include "huffman.hh"
 
 namespace huffman {
-    constexpr int NUM_VALUES = 257;
+    /* In adaptive mode, a symbol seen for the first time is sent as the code
+     * of the NYT leaf followed by its raw value in ESCAPE_BITS bits. */
+    constexpr int ESCAPE_BITS = 9;
 
     struct Huffman::Impl {
-        std::unordered_map<int, int> charFreq;
-        std::unordered_map<const tree::PtrTree*, int> depths;
-        tree::PtrTree *tree;
+        config_t config;
+        uint64_t untilRebuild; // Symbols left before the next rebuild
+        uint64_t period;       // Current distance between rebuilds
+        AdaptiveTree adaptive{NUM_VALUES};
+        std::vector<uint64_t> charFreq = std::vector<uint64_t>(NUM_VALUES);
+        // The values in order of count (fewest first), and where each value
+        // is in that order. Kept sorted as the counts go up.
+        std::vector<int> byCount;
+        std::vector<int> rank;
+        tree::Tree *tree;
+        // PtrTree nodes, recycled from one rebuild to the next
+        tree::NodePool nodes{ 2 * NUM_VALUES - 1 };
+        // In ARRAY mode, every rebuild is laid out in the same ArrayTree
+        std::unique_ptr<tree::ArrayTree> array;
+        tree::ArrayTreeBuilder builder;
+        CodeBook codes; // Canonical codes for the current tree's code lengths
+
+        // Scratch space for rebuilds, kept to save allocating it each time
+        std::vector<unsigned> lengths = std::vector<unsigned>(NUM_VALUES);
+        std::vector<std::pair<tree::Tree::Cursor, unsigned>> pending;
+        std::vector<std::pair<uint64_t, uintptr_t>> merged;
+        PackageMergeScratch limiting;
+
+        void dropTree() {
+            nodes.clear();
+            tree = NULL;
+        }
     };
 
-    Huffman::Huffman() noexcept {
+    Huffman::Huffman(update_t update) noexcept
+        : Huffman(config_t{ update, 1 })
+    { }
+
+    Huffman::Huffman(const config_t& config) noexcept {
         pImpl_ = std::unique_ptr<Impl>(new Impl);
+        pImpl_->config = config;
+        pImpl_->config.interval = std::max<uint32_t>(config.interval, 1);
+        if (config.max_length == 0 || config.max_length > CodeBook::MAX_LENGTH) {
+            pImpl_->config.max_length = CodeBook::MAX_LENGTH;
+        } else {
+            pImpl_->config.max_length = std::max(config.max_length, MIN_LENGTH);
+        }
+        /* A geometric schedule starts by rebuilding after every symbol and
+         * doubles the period each time, up to the configured interval. */
+        if (config.update == update_t::GEOMETRIC) {
+            pImpl_->period = 1;
+        } else {
+            pImpl_->period = pImpl_->config.interval;
+        }
+        pImpl_->untilRebuild = pImpl_->period;
         for (int i = 0; i < NUM_VALUES; i++) {
-            pImpl_->charFreq[i] = 0;
+            pImpl_->byCount.push_back(i);
+            pImpl_->rank.push_back(i);
         }
         pImpl_->tree = NULL;
-        recreate_tree();
+        if (config.update != update_t::ADAPTIVE) {
+            /* A rebuild's walk over the tree never holds more than one
+             * node per level. */
+            pImpl_->pending.reserve(NUM_VALUES);
+            pImpl_->merged.reserve(NUM_VALUES - 1);
+            /* With a limit of its own, a tree is likely to outgrow it. */
+            if (pImpl_->config.max_length < CodeBook::MAX_LENGTH) {
+                pImpl_->limiting.reserve(NUM_VALUES, pImpl_->config.max_length);
+            }
+            recreate_tree();
+        }
     }
 
     void Huffman::incFreq(symbol_t symbol) {
-        pImpl_->charFreq[symbol]++;
+        if (pImpl_->config.update == update_t::ADAPTIVE) {
+            pImpl_->adaptive.update(symbol);
+            return;
+        }
 
-        recreate_tree();
+        /* The symbol's count is one more than any other value's with the
+         * same count (and no more than any higher count), so trading places
+         * with the last of those keeps the order sorted. */
+        auto& freq = pImpl_->charFreq;
+        auto& byCount = pImpl_->byCount;
+        auto& rank = pImpl_->rank;
+        const auto count = freq[symbol]++;
+        const auto from = rank[symbol];
+        const int to = std::upper_bound(byCount.begin() + from + 1, byCount.end(), count,
+                                        [&freq](uint64_t count, int value) {
+                                            return count < freq[value];
+                                        }) - byCount.begin() - 1;
+        std::swap(byCount[from], byCount[to]);
+        rank[byCount[from]] = from;
+        rank[byCount[to]] = to;
+
+        if (pImpl_->config.update != update_t::STATIC && --pImpl_->untilRebuild == 0) {
+            recreate_tree();
+            if (pImpl_->config.update == update_t::GEOMETRIC) {
+                pImpl_->period = std::min<uint64_t>(pImpl_->period * 2,
+                                                    pImpl_->config.interval);
+            }
+            pImpl_->untilRebuild = pImpl_->period;
+        }
     }
 
     Huffman::~Huffman() noexcept {
-        delete pImpl_->tree;
+        pImpl_->dropTree();
     }
 
     Huffman::encoding_t Huffman::encode(symbol_t c) const {
-        encoding_t encoding;
-        std::string path = pImpl_->tree->pathTo(static_cast<int>(c));
-        for (auto ch : path) {
-            if (ch == 'L') {
-                encoding.push_back(ZERO);
-            } else {
-                encoding.push_back(ONE);
-            }
-        }
-        return encoding;
+        return path_to(c);
+    }
+
+    void Huffman::encode(symbol_t c, BitWriter& out) const {
+        write_code(c, out);
     }
 
     Huffman::symbol_t Huffman::decode(enc_iter_t& begin, const enc_iter_t& end) const noexcept(false) {
-        std::string path = "";
-        int return_value = 0;
-        for (auto i = begin; i != end; i++) {
-            if (*i == ZERO) {
-                path += "L";
-            } else {
-                path += "R";
-            }
-            auto value = pImpl_->tree->getByPath(path);
-            if (value < NUM_VALUES) {
+        if (pImpl_->config.update == update_t::ADAPTIVE) {
+            /* Walk down from the root; an NYT leaf is followed by the raw
+             * symbol. Running out of bits is treated like EOF. */
+            const auto& adaptive = pImpl_->adaptive;
+            auto i = begin;
+            int node = adaptive.root();
+            while (!adaptive.isLeaf(node) && i != end) {
+                node = adaptive.child(node, *i++ == ONE);
+            }
+            if (!adaptive.isLeaf(node)) {
+                begin = end;
+                return 0;
+            }
+
+            int value = adaptive.value(node);
+            if (adaptive.isNYT(node)) {
+                value = 0;
+                for (int bit = 0; bit < ESCAPE_BITS; bit++) {
+                    if (i == end) {
+                        begin = end;
+                        return 0;
+                    }
+                    value = (value << 1) | (*i++ == ONE);
+                }
+                if (value >= NUM_VALUES) {
+                    throw std::runtime_error("invalid escaped symbol!");
+                }
+            }
+
+            if (value == NUM_VALUES-1) {
+                begin = end;
+                return 0;
+            }
+            begin = i;
+            return static_cast<symbol_t>(value);
+        }
+
+        /* Most codes are resolved by a single lookup of the next few bits. */
+        const auto& codes = pImpl_->codes;
+        uint32_t window = 0;
+        unsigned available = 0;
+        for (auto i = begin; i != end && available < CodeBook::TABLE_BITS; i++) {
+            window |= uint32_t(*i == ONE) << available++;
+        }
+        const auto& entry = codes.peek(window);
+        if (entry.length != 0 && entry.length <= available) {
+            if (entry.value == NUM_VALUES-1) {
+                begin = end;
+                return 0;
+            }
+            begin += entry.length;
+            return static_cast<symbol_t>(entry.value);
+        }
+
+        /* Longer codes: grow the prefix one bit at a time until it's a
+         * complete canonical code. */
+        uint64_t prefix = 0;
+        unsigned length = 0;
+        for (auto i = begin; i != end; ) {
+            prefix = (prefix << 1) | (*i++ == ONE);
+            length++;
+            CodeBook::value_t value;
+            if (codes.lookup(length, prefix, value)) {
                 if (value == NUM_VALUES-1) {
                     begin = end;
-                } else {
-                    return_value = value;
-                    begin = i + 1;
+                    return 0;
                 }
-                break;
+                begin = i;
+                return static_cast<symbol_t>(value);
+            }
+            if (length == CodeBook::MAX_LENGTH) {
+                throw std::runtime_error("invalid code!");
             }
         }
-        return static_cast<symbol_t>(return_value);
+        begin = end;
+        return 0;
+    }
+
+    unsigned Huffman::decode(BitReader& in, symbol_t& symbol) const noexcept(false) {
+        if (pImpl_->config.update == update_t::ADAPTIVE) {
+            /* Same walk as above, one bit at a time. */
+            const auto& adaptive = pImpl_->adaptive;
+            unsigned length = 0;
+            int node = adaptive.root();
+            while (!adaptive.isLeaf(node)) {
+                if (!in.bitsLeft()) {
+                    return 0;
+                }
+                node = adaptive.child(node, in.peek(1));
+                in.skip(1);
+                length++;
+            }
+
+            int value = adaptive.value(node);
+            if (adaptive.isNYT(node)) {
+                if (in.bitsLeft() < ESCAPE_BITS) {
+                    in.skipToEnd();
+                    return 0;
+                }
+                const auto bits = in.read(ESCAPE_BITS);
+                value = 0;
+                for (int bit = 0; bit < ESCAPE_BITS; bit++) {
+                    value = (value << 1) | ((bits >> bit) & 1);
+                }
+                if (value >= NUM_VALUES) {
+                    throw std::runtime_error("invalid escaped symbol!");
+                }
+                length += ESCAPE_BITS;
+            }
+
+            if (value == NUM_VALUES-1) {
+                in.skipToEnd();
+                return 0;
+            }
+            symbol = static_cast<symbol_t>(value);
+            return length;
+        }
+
+        /* Most codes are resolved by a single lookup of the next few bits
+         * (missing bits past the end of input read as zeros). */
+        const auto& codes = pImpl_->codes;
+        const auto& entry = codes.peek(in.peek(CodeBook::TABLE_BITS));
+        if (entry.length != 0 && entry.length <= in.bitsLeft()) {
+            if (entry.value == NUM_VALUES-1) {
+                in.skipToEnd();
+                return 0;
+            }
+            in.skip(entry.length);
+            symbol = static_cast<symbol_t>(entry.value);
+            return entry.length;
+        }
+
+        /* Longer codes: grow the prefix one bit at a time. */
+        uint64_t prefix = 0;
+        for (unsigned length = 1; in.bitsLeft(); length++) {
+            prefix = (prefix << 1) | in.peek(1);
+            in.skip(1);
+            CodeBook::value_t value;
+            if (codes.lookup(length, prefix, value)) {
+                if (value == NUM_VALUES-1) {
+                    in.skipToEnd();
+                    return 0;
+                }
+                symbol = static_cast<symbol_t>(value);
+                return length;
+            }
+            if (length == CodeBook::MAX_LENGTH) {
+                throw std::runtime_error("invalid code!");
+            }
+        }
+        return 0;
     }
 
     Huffman::encoding_t Huffman::eofCode() const {
+        return path_to(NUM_VALUES-1);
+    }
+
+    void Huffman::eofCode(BitWriter& out) const {
+        write_code(NUM_VALUES-1, out);
+    }
+
+    void Huffman::rebuild() {
+        if (pImpl_->config.update == update_t::ADAPTIVE) {
+            throw std::runtime_error("adaptive models can't be rebuilt!");
+        }
+        recreate_tree();
+    }
+
+    std::vector<unsigned> Huffman::codeLengths() const {
+        if (pImpl_->config.update == update_t::ADAPTIVE) {
+            throw std::runtime_error("adaptive models have no fixed code lengths!");
+        }
+        std::vector<unsigned> lengths(NUM_VALUES);
+        for (int value = 0; value < NUM_VALUES; value++) {
+            lengths[value] = pImpl_->codes.code(value).length;
+        }
+        return lengths;
+    }
+
+    void Huffman::setCodeLengths(const std::vector<unsigned>& lengths) {
+        if (pImpl_->config.update == update_t::ADAPTIVE) {
+            throw std::runtime_error("adaptive models have no fixed code lengths!");
+        }
+        if (lengths.size() != NUM_VALUES ||
+                std::find(lengths.begin(), lengths.end(), 0) != lengths.end()) {
+            throw std::runtime_error("every value needs a code!");
+        }
+        pImpl_->codes.assign(lengths);
+    }
+
+    size_t Huffman::memoryUsage() const {
+        const auto& impl = *pImpl_;
+        size_t usage = sizeof(*this) + sizeof(impl) + impl.adaptive.memoryUsage() +
+            impl.nodes.memoryUsage() + impl.codes.memoryUsage() +
+            impl.charFreq.capacity() * sizeof(impl.charFreq[0]) +
+            (impl.byCount.capacity() + impl.rank.capacity()) * sizeof(int) +
+            impl.lengths.capacity() * sizeof(impl.lengths[0]) +
+            impl.pending.capacity() * sizeof(impl.pending[0]) +
+            impl.merged.capacity() * sizeof(impl.merged[0]) + impl.builder.memoryUsage() +
+            impl.limiting.memoryUsage();
+        if (impl.array) {
+            usage += sizeof(*impl.array) + impl.array->memoryUsage();
+        }
+        return usage;
+    }
+
+    Huffman::encoding_t Huffman::path_to(int value) const {
         encoding_t encoding;
-        std::string path = pImpl_->tree->pathTo(NUM_VALUES-1);
-        for (auto ch : path) {
-            if (ch == 'L') {
-                encoding.push_back(ZERO);
-            } else {
-                encoding.push_back(ONE);
+        if (pImpl_->config.update == update_t::ADAPTIVE) {
+            /* Collect the turns from the leaf up to the root, then flip
+             * them around. */
+            const auto& adaptive = pImpl_->adaptive;
+            const int leaf = adaptive.leaf(value);
+            for (int node = leaf; node != adaptive.root(); node = adaptive.parent(node)) {
+                encoding.push_back(adaptive.isRight(node) ? ONE : ZERO);
+            }
+            std::reverse(encoding.begin(), encoding.end());
+            if (adaptive.isNYT(leaf)) {
+                for (int bit = ESCAPE_BITS - 1; bit >= 0; bit--) {
+                    encoding.push_back(bit_t((value >> bit) & 1));
+                }
             }
+            return encoding;
+        }
+
+        const auto& code = pImpl_->codes.code(value);
+        for (unsigned bit = 0; bit < code.length; bit++) {
+            encoding.push_back(bit_t((code.bits >> bit) & 1));
         }
         return encoding;
     }
 
-    int Huffman::weight(const tree::PtrTree* const tree) const {
-        /* Get the weight of a given tree. If it represents a character,
-         * look it up in the character frequency map; otherwise, just
-         * return its key value. */
-        if (tree->size() == 1) {
-            return pImpl_->charFreq[tree->getByPath("")];
-        } else {
-            return tree->getByPath("") - NUM_VALUES;
+    void Huffman::write_code(int value, BitWriter& out) const {
+        if (pImpl_->config.update == update_t::ADAPTIVE) {
+            /* The turns come out leaf first: stack them up, then write them
+             * root first, a word at a time. A path can't be longer than
+             * the number of leaves. */
+            const auto& adaptive = pImpl_->adaptive;
+            const int leaf = adaptive.leaf(value);
+            bool turns[NUM_VALUES + 1];
+            unsigned depth = 0;
+            for (int node = leaf; node != adaptive.root(); node = adaptive.parent(node)) {
+                turns[depth++] = adaptive.isRight(node);
+            }
+            uint64_t bits = 0;
+            unsigned length = 0;
+            while (depth) {
+                bits |= uint64_t(turns[--depth]) << length;
+                if (++length == 64) {
+                    out.write(bits, length);
+                    bits = 0;
+                    length = 0;
+                }
+            }
+            out.write(bits, length);
+
+            /* The raw value goes most significant bit first. */
+            if (adaptive.isNYT(leaf)) {
+                uint64_t escape = 0;
+                for (int bit = 0; bit < ESCAPE_BITS; bit++) {
+                    escape |= uint64_t((value >> (ESCAPE_BITS - 1 - bit)) & 1) << bit;
+                }
+                out.write(escape, ESCAPE_BITS);
+            }
+            return;
         }
-    }
 
-    int Huffman::weight(const tree::PtrTree& tree) const {
-        /* Let it be called not using a pointer, for safety.
-         * We need the pointer version sometimes because ptrtree
-         * doesn't have a copy constructor so we can't call
-         * weight(*treeptr) */
-        return weight(&tree);
+        const auto& code = pImpl_->codes.code(value);
+        out.write(code.bits, code.length);
     }
 
+    /* How build_tree makes the trees of its forest. Both kinds name a tree
+     * by a uintptr_t, the way a tree::Tree::Cursor names a node. PtrTrees
+     * come from the model's node pool, and can just be linked; ArrayTrees
+     * are noted down in the model's builder, and laid out in one array once
+     * the whole tree is known. */
+    struct ptr_forest_t {
+        tree::NodePool& nodes;
+
+        uintptr_t leaf(tree::Tree::value_t value) {
+            return reinterpret_cast<uintptr_t>(nodes.leaf(value));
+        }
+        uintptr_t join(tree::Tree::value_t root, uintptr_t left, uintptr_t right) {
+            return reinterpret_cast<uintptr_t>(
+                nodes.join(root, *reinterpret_cast<const tree::PtrTree*>(left),
+                           *reinterpret_cast<const tree::PtrTree*>(right)));
+        }
+        tree::Tree* finish(uintptr_t root) {
+            return reinterpret_cast<tree::PtrTree*>(root);
+        }
+    };
+
+    struct array_forest_t {
+        tree::ArrayTreeBuilder& builder;
+        tree::ArrayTree& tree;
+
+        uintptr_t leaf(tree::Tree::value_t value) {
+            return builder.leaf(value);
+        }
+        uintptr_t join(tree::Tree::value_t root, uintptr_t left, uintptr_t right) {
+            return builder.join(root, tree::ArrayTreeBuilder::node_t(left),
+                                tree::ArrayTreeBuilder::node_t(right));
+        }
+        tree::Tree* finish(uintptr_t root) {
+            builder.build(tree::ArrayTreeBuilder::node_t(root), tree);
+            return &tree;
+        }
+    };
+
     void Huffman::recreate_tree() {
-        /* Our PtrTrees only support integers. To get around this, since
-         * we're only encoding bytes, we can use numbers from 0-255 to
-         * represent the encoded characters. We can tell which meaning is
-         * meant because encoded characters always occur at leaf nodes --
-         * so they will always have a size of 1. HOWEVER, we also want to
-         * be able to use pathTo, which assumes the tree has unique keys.
-         * So to avoid overlap, we'll add NUM_VALUES (= 257) to the nodes
-         * that represent frequencies, and reserve 0-255 for only character
-         * values. (256 represents the EOF character.) */
-
-        /* (we don't need to worry about the duplicate keys when talking about
-         * frequencies, because we never look up tree nodes by weight -- it
-         * only matters that all possible character values are distinct from
-         * any weight value.) */
-
-        /* Unfortunately apparently they are a nightmare to put into
-         * a priority queue, since the comparison depends on a member variable,
-         * which is apparently anathema to C++. */
-
-        auto compare = [&](const tree::PtrTree* const left, const tree::PtrTree* const right) {
-            if (weight(left) == weight(right)) {
-                /* Use tree depth as a "tiebreaker", to cause trees to be
-                 * more well-balanced when they have a bunch of zeroes. This
-                 * will reduce the length of codes for symbols we're seeing
-                 * for the first time. */
-                return pImpl_->depths[left] > pImpl_->depths[right];
-            } else {
-                return weight(left) > weight(right);
+        if (pImpl_->config.tree == tree_t::ARRAY) {
+            if (!pImpl_->array) {
+                pImpl_->array.reset(new tree::ArrayTree(0));
             }
-        };
+            build_tree(array_forest_t{ pImpl_->builder, *pImpl_->array });
+        } else {
+            build_tree(ptr_forest_t{ pImpl_->nodes });
+        }
+    }
+
+    template <typename Forest>
+    void Huffman::build_tree(Forest forest) {
+        /* Our trees only hold unsigned values, and we only encode bytes, so
+         * the values 0-255 stand for the encoded characters (and 256 for
+         * EOF) at the leaves. pathTo assumes the tree has unique keys, so
+         * the internal nodes are numbered from NUM_VALUES up. Their weights
+         * (which can outgrow a tree value on big inputs) travel alongside
+         * the trees in the forest instead. */
 
-        std::priority_queue<tree::PtrTree*, std::vector<tree::PtrTree*>, decltype(compare)> forest(compare);
+        /* The old tree's nodes make room for the new one's. */
+        pImpl_->dropTree();
 
-        /* First, we put all the individual nodes into the priority queue. */
-        for (auto pair : pImpl_->charFreq) {
-            tree::PtrTree *basetree = new tree::PtrTree(static_cast<int>(pair.first));
-            pImpl_->depths[basetree] = 0;
-            forest.push(basetree);
+        /* The leaves are already sorted by weight, and every merged tree
+         * weighs at least as much as the one merged before it. So the
+         * lightest tree in the forest is always at the front of one of the
+         * two queues, and building the tree takes linear time.
+         *
+         * On a tie, the leaf goes first: that keeps the tree as shallow as
+         * it can be (a merged tree is deeper than a leaf), and so gives
+         * short codes to the many symbols we haven't seen yet. */
+        const auto& freq = pImpl_->charFreq;
+        const auto& leaves = pImpl_->byCount;
+        auto& merged = pImpl_->merged;
+        merged.clear();
+        size_t next_leaf = 0, next_merged = 0;
+        auto take = [&]() {
+            if (next_leaf < leaves.size() &&
+                    (next_merged == merged.size() ||
+                     freq[leaves[next_leaf]] <= merged[next_merged].first)) {
+                const auto value = leaves[next_leaf++];
+                return std::make_pair(freq[value],
+                                      forest.leaf(static_cast<tree::Tree::value_t>(value)));
+            }
+            return merged[next_merged++];
+        };
+
+        /* Then, we repeat until we only have one tree: combine the two
+         * lightest ones into a new tree, and put it at the back of the
+         * queue. */
+        tree::Tree::value_t next_node = NUM_VALUES;
+        for (int joins = 0; joins < NUM_VALUES - 1; joins++) {
+            const auto tree1 = take();
+            const auto tree2 = take();
+            merged.push_back({ tree1.first + tree2.first,
+                               forest.join(next_node++, tree2.second, tree1.second) });
         }
 
-        /* Then, we repeat until we only have one tree... */
-        while (forest.size() > 1) {
-            /* get and remove top two elements */
-            const tree::PtrTree *tree1 = forest.top();
-            forest.pop();
-            const tree::PtrTree *tree2 = forest.top();
-            forest.pop();
+        pImpl_->tree = forest.finish(merged.back().second);
 
-            /* combine them into a new tree, and put it back into the forest */
-            tree::PtrTree *newtree = new tree::PtrTree(weight(tree1) + weight(tree2) + NUM_VALUES, tree2, tree1);
-            pImpl_->depths[newtree] = std::max(pImpl_->depths[tree1], pImpl_->depths[tree2]) + 1;
-            forest.push(newtree);
+        /* The tree only decides how long each code is: the codes themselves
+         * are canonical, so encoding is a table lookup. Each code is as long
+         * as its leaf is deep, so one walk over the tree finds them all. */
+        auto& lengths = pImpl_->lengths;
+        auto& pending = pImpl_->pending;
+        pending.assign(1, { pImpl_->tree->cursor(), 0 });
+        while (!pending.empty()) {
+            auto node = pending.back().first;
+            const auto depth = pending.back().second;
+            pending.pop_back();
+            if (node.isLeaf()) {
+                lengths[node.value()] = depth;
+                continue;
+            }
+            auto right = node;
+            if (right.right()) {
+                pending.push_back({ right, depth + 1 });
+            }
+            if (node.left()) {
+                pending.push_back({ node, depth + 1 });
+            }
         }
 
-        delete pImpl_->tree;
-        pImpl_->tree = forest.top();
+        /* Skewed counts can make the tree deeper than the length limit;
+         * only then do we need the (slower) length-limited construction. */
+        if (*std::max_element(lengths.begin(), lengths.end()) > pImpl_->config.max_length) {
+            package_merge(pImpl_->charFreq, pImpl_->config.max_length,
+                          pImpl_->limiting, lengths);
+        }
+        pImpl_->codes.assign(lengths);
     }
 }
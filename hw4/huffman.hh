@@ -4,14 +4,19 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <memory>
 #include <vector>
 
-#include "ptrtree.hh"
+#include "tree.hh"
 
 namespace huffman {
 
+class BitReader;
+class BitWriter;
+
 class Huffman {
   public:
     using symbol_t = uint8_t; // All encoded symbols are bytes
@@ -20,8 +25,41 @@ class Huffman {
     using encoding_t = std::vector<bit_t>;
     using enc_iter_t = encoding_t::const_iterator;
 
+    // How the code follows the symbol frequencies:
+    enum class update_t {
+        ADAPTIVE,  // Adjust the tree in place after every symbol (FGK)
+        REBUILD,   // Rebuild the whole tree every `interval` symbols
+        GEOMETRIC, // Rebuild after 1, 2, 4, 8... symbols, at most `interval` apart
+        STATIC,    // Only change the code on rebuild() or setCodeLengths()
+    };
+
+    // Which tree::Tree implementation the rebuilding modes construct:
+    enum class tree_t {
+        POINTER, // tree::PtrTree: one heap allocation per node
+        ARRAY,   // tree::ArrayTree: all nodes in one contiguous array
+    };
+
+    // Number of distinct codes: every symbol, plus EOF.
+    static constexpr int NUM_VALUES = 257;
+
+    // Shortest usable code length limit: enough for 257 distinct codes.
+    static constexpr unsigned MIN_LENGTH = 9;
+
+    // Model options. Encoder and decoder must use the same update and
+    // interval; the tree implementation doesn't change the code.
+    struct config_t {
+        update_t update = update_t::ADAPTIVE;
+        uint32_t interval = 1; // Rebuild period (or its cap), ignored by ADAPTIVE
+        // Longest code the rebuilding modes may assign (MIN_LENGTH and up, or
+        // 0 for no limit of its own); ignored by ADAPTIVE.
+        unsigned max_length = 0;
+        tree_t tree = tree_t::POINTER;
+    };
+
     // Initialize object: all symbol frequencies (counts) start at zero.
-    Huffman() noexcept;
+    // Encoder and decoder must use the same update policy.
+    explicit Huffman(update_t update = update_t::ADAPTIVE) noexcept;
+    explicit Huffman(const config_t& config) noexcept;
     ~Huffman() noexcept;
 
     // For a given input symbol, increment its frequency (count), and
@@ -33,23 +71,61 @@ class Huffman {
     // frequent symbols).
     encoding_t encode(symbol_t symbol) const;
 
+    // Append symbol's code to out without building a vector (the bits are
+    // the same as encode()'s).
+    void encode(symbol_t symbol, BitWriter& out) const;
+
     // For a given range to code of 0s and 1s, return the first unique
     // symbol represented by a prefix in the encoding.
     // Adjust the beginning of the range forward to just past the
     // unique prefix that was discoverd.
+    // On the EOF code, or if the range runs out mid-code, begin is moved to
+    // end and 0 is returned.
     // Throws a runtime exception if the code is invalid.
     symbol_t decode(enc_iter_t& begin, const enc_iter_t& end) const noexcept(false);
 
+    // Decode the next symbol straight from packed bits, consuming its code,
+    // and return the code's length. At the EOF code, or if the input runs
+    // out mid-code, all the input is consumed and 0 is returned.
+    // Throws a runtime exception if the code is invalid.
+    unsigned decode(BitReader& in, symbol_t& symbol) const noexcept(false);
+
     // Return a code that represents no valid symbol (or prefix thereof).
     encoding_t eofCode() const;
+    void eofCode(BitWriter& out) const;
+
+    // Rebuild the code right now from the frequencies counted so far, e.g.
+    // after a STATIC model has counted a whole input.
+    // Throws a runtime_error for ADAPTIVE models.
+    void rebuild();
+
+    // The length of every value's code (symbols first, then EOF). Together
+    // with the update mode this is all a decoder needs to reproduce the code.
+    // Throws a runtime_error for ADAPTIVE models.
+    std::vector<unsigned> codeLengths() const;
+
+    // Replace the code with the canonical code for the given lengths, as
+    // returned by codeLengths(). A STATIC model then keeps it for good.
+    // Throws a runtime_error for ADAPTIVE models or invalid lengths.
+    void setCodeLengths(const std::vector<unsigned>& lengths);
+
+    // Memory taken up by the model, in bytes: this object and everything it
+    // allocated. It depends only on the configuration, not on how many
+    // symbols the model has seen, so it stays the same however long the
+    // input runs. (The one exception: a model with no max_length of its own
+    // sets aside room to limit its codes the first time its tree outgrows
+    // CodeBook::MAX_LENGTH, which takes astronomically skewed counts.)
+    // Rebuilds reuse the model's memory rather than allocating.
+    size_t memoryUsage() const;
 
   private:
     struct Impl;
     std::unique_ptr<Impl> pImpl_;
 
     void recreate_tree();
-    int weight(const tree::PtrTree* const tree) const;
-    int weight(const tree::PtrTree& tree) const;
+    template <typename Forest> void build_tree(Forest forest);
+    encoding_t path_to(int value) const;
+    void write_code(int value, BitWriter& out) const;
 };
 
 } // namespace
@@ -0,0 +1,101 @@
+/*
+ * MappedInput and MappedOutput: mmap(2) wrappers.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped.hh"
+
+namespace huffman {
+
+    static std::runtime_error file_error(const char* what, const char* path) {
+        return std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(errno));
+    }
+
+    MappedInput::MappedInput(const char* path) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            throw file_error("Can't open", path);
+        }
+        try {
+            map(fd, path);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);  // The mapping keeps the file open
+    }
+
+    MappedInput::MappedInput(int fd, const char* name) {
+        map(fd, name);
+    }
+
+    void MappedInput::map(int fd, const char* name) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            throw file_error("Can't stat", name);
+        }
+        const off_t offset = lseek(fd, 0, SEEK_CUR);
+        if (offset < 0) {
+            throw file_error("Can't seek", name);
+        }
+        if (offset >= st.st_size) {
+            return;
+        }
+        /* Mappings start on a page boundary. */
+        skip_ = offset % sysconf(_SC_PAGESIZE);
+        size_ = st.st_size - offset;
+        void* data = mmap(nullptr, skip_ + size_, PROT_READ, MAP_PRIVATE, fd, offset - skip_);
+        if (data == MAP_FAILED) {
+            size_ = 0;
+            throw file_error("Can't map", name);
+        }
+        /* It's read front to back, mostly. */
+        madvise(data, skip_ + size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(data) + skip_;
+    }
+
+    MappedInput::~MappedInput() {
+        if (data_) {
+            munmap(const_cast<char*>(data_ - skip_), skip_ + size_);
+        }
+    }
+
+    MappedOutput::MappedOutput(const char* path, size_t size)
+        : size_(size)
+    {
+        const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            throw file_error("Can't create", path);
+        }
+        if (ftruncate(fd, size_) != 0) {
+            const auto error = file_error("Can't resize", path);
+            close(fd);
+            throw error;
+        }
+        if (size_) {
+            void* data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                const auto error = file_error("Can't map", path);
+                close(fd);
+                throw error;
+            }
+            data_ = static_cast<char*>(data);
+        }
+        close(fd);
+    }
+
+    MappedOutput::~MappedOutput() {
+        if (data_) {
+            munmap(data_, size_);
+        }
+    }
+
+} // namespace huffman
@@ -0,0 +1,60 @@
+/*
+ * mapped.hh: files mapped into memory, so the tools can read a large input
+ * (or fill in an output whose size they know) without copying it through
+ * stdio.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace huffman {
+
+// A whole file, mapped read-only.
+class MappedInput {
+  public:
+    // Map the file at path.
+    // Throws a runtime_error if it can't be opened or mapped.
+    explicit MappedInput(const char* path);
+    // Map the open file fd (a regular file) from its current position to
+    // its end, leaving the position alone. name is for error messages.
+    // Throws a runtime_error if it can't be mapped.
+    MappedInput(int fd, const char* name);
+    ~MappedInput();
+
+    MappedInput(const MappedInput&) = delete;
+    MappedInput& operator=(const MappedInput&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    const char* data_ = nullptr;  // Null for an empty file
+    size_t size_ = 0;
+    size_t skip_ = 0;  // Bytes mapped in front of data_, to a page boundary
+
+    void map(int fd, const char* name);
+};
+
+// A new file of a given size, mapped for writing. Whatever is written to
+// data() ends up in the file.
+class MappedOutput {
+  public:
+    // Create (or truncate) the file at path, make it `size` bytes long and
+    // map it.
+    // Throws a runtime_error if it can't be created or mapped.
+    MappedOutput(const char* path, size_t size);
+    ~MappedOutput();
+
+    MappedOutput(const MappedOutput&) = delete;
+    MappedOutput& operator=(const MappedOutput&) = delete;
+
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    char* data_ = nullptr;  // Null for an empty file
+    size_t size_ = 0;
+};
+
+} // namespace
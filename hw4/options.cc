@@ -0,0 +1,39 @@
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "options.hh"
+
+namespace huffman {
+
+    uint64_t parse_count(const char* arg, const char* what, uint64_t max) {
+        char* end = nullptr;
+        errno = 0;
+        const auto value = std::strtoull(arg, &end, 10);
+        if (errno || *arg == '-' || end == arg || *end != '\0' || value == 0 || value > max) {
+            std::cerr << "Invalid " << what << ": " << arg
+                      << " (expected 1.." << max << ")\n";
+            std::exit(1);
+        }
+        return value;
+    }
+
+    uint64_t parse_size(const char* arg, const char* what, uint64_t max) {
+        std::string number = arg;
+        unsigned shift = 0;
+        if (!number.empty()) {
+            switch (number.back()) {
+              case 'K': case 'k': shift = 10; break;
+              case 'M': case 'm': shift = 20; break;
+              case 'G': case 'g': shift = 30; break;
+            }
+        }
+        if (shift) {
+            number.pop_back();
+        }
+        const auto value = parse_count(number.c_str(), what, max >> shift);
+        return value << shift;
+    }
+
+} // namespace huffman
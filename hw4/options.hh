@@ -0,0 +1,19 @@
+/*
+ * options.hh: helpers for parsing the command-line options of the
+ * compression tools.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace huffman {
+
+// Parse arg as an integer between 1 and max. Prints an error naming the
+// option `what` and exits if it isn't one.
+uint64_t parse_count(const char* arg, const char* what, uint64_t max);
+
+// Like parse_count, but also accepts a K, M or G suffix (powers of 1024).
+uint64_t parse_size(const char* arg, const char* what, uint64_t max);
+
+} // namespace
@@ -0,0 +1,113 @@
+/*
+ * Package-merge: think of each symbol as a coin worth 2^-length for every
+ * length from 1 to max_length. Buying 2n-2 units of the cheapest coins
+ * (where "packages" of two coins at one level compete with single coins at
+ * the level above) gives each symbol its code length: the number of its
+ * coins that were bought.
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include "packagemerge.hh"
+
+namespace huffman {
+
+    void PackageMergeScratch::reserve(size_t n, unsigned max_length) {
+        /* A level holds every symbol, plus at most one package for every
+         * two items at the level below. */
+        order_.reserve(n);
+        if (levels_.size() < max_length) {
+            levels_.resize(max_length);
+        }
+        for (auto& level : levels_) {
+            level.reserve(2 * n);
+        }
+    }
+
+    size_t PackageMergeScratch::memoryUsage() const {
+        size_t usage = order_.capacity() * sizeof(unsigned) +
+            levels_.capacity() * sizeof(levels_[0]);
+        for (const auto& level : levels_) {
+            usage += level.capacity() * sizeof(item_t);
+        }
+        return usage;
+    }
+
+    std::vector<unsigned> package_merge(const std::vector<uint64_t>& weights,
+                                        unsigned max_length) {
+        PackageMergeScratch scratch;
+        std::vector<unsigned> lengths;
+        package_merge(weights, max_length, scratch, lengths);
+        return lengths;
+    }
+
+    void package_merge(const std::vector<uint64_t>& weights, unsigned max_length,
+                       PackageMergeScratch& scratch, std::vector<unsigned>& lengths) {
+        const auto n = weights.size();
+        lengths.assign(n, 0);
+        if (n < 2) {
+            lengths.assign(n, 1);
+            return;
+        }
+        if (max_length == 0 || max_length >= 64 || (uint64_t(1) << max_length) < n) {
+            throw std::runtime_error("maximum code length too short for alphabet!");
+        }
+        scratch.reserve(n, max_length);
+
+        /* Ties go by symbol, which makes the order the same as a stable
+         * sort's (without the stable sort's temporary buffer). */
+        auto& order = scratch.order_;
+        order.resize(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+            return weights[a] < weights[b] || (weights[a] == weights[b] && a < b);
+        });
+
+        /* levels[0] holds the coins for the first bit of every code,
+         * levels[max_length-1] those for the last possible bit. Each list is
+         * sorted by weight; packages are marked with symbol -1. */
+        auto& levels = scratch.levels_;
+        for (auto& level : levels) {
+            level.clear();
+        }
+        for (auto symbol : order) {
+            levels[max_length - 1].push_back({ weights[symbol], int(symbol) });
+        }
+        for (int level = max_length - 2; level >= 0; level--) {
+            const auto& deeper = levels[level + 1];
+            auto& list = levels[level];
+            const auto packages = deeper.size() / 2;
+            size_t leaf = 0, package = 0;
+            while (leaf < n || package < packages) {
+                const auto packed = package < packages
+                    ? deeper[2 * package].weight + deeper[2 * package + 1].weight : 0;
+                if (package == packages || (leaf < n && weights[order[leaf]] <= packed)) {
+                    list.push_back({ weights[order[leaf]], int(order[leaf]) });
+                    leaf++;
+                } else {
+                    list.push_back({ packed, -1 });
+                    package++;
+                }
+            }
+        }
+
+        /* Take the 2n-2 cheapest items at the top; every package taken at
+         * one level means taking its two items at the next. */
+        size_t take = 2 * n - 2;
+        for (unsigned level = 0; level < max_length && take > 0; level++) {
+            size_t packages = 0;
+            for (size_t i = 0; i < take; i++) {
+                const auto& item = levels[level][i];
+                if (item.symbol < 0) {
+                    packages++;
+                } else {
+                    lengths[item.symbol]++;
+                }
+            }
+            take = 2 * packages;
+        }
+    }
+
+} // namespace huffman
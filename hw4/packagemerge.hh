@@ -0,0 +1,50 @@
+/*
+ * packagemerge.hh: optimal length-limited Huffman code lengths, using the
+ * package-merge algorithm (Larmore and Hirschberg).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace huffman {
+
+// Working space for package_merge, which can be kept from one call to the
+// next: once it has been through a call (or reserve()) for an alphabet and
+// length limit, later calls for the same ones don't allocate.
+class PackageMergeScratch {
+  public:
+    // Make room for n symbols and codes up to max_length long.
+    void reserve(size_t n, unsigned max_length);
+
+    // Heap memory held, in bytes.
+    size_t memoryUsage() const;
+
+  private:
+    friend void package_merge(const std::vector<uint64_t>&, unsigned,
+                              PackageMergeScratch&, std::vector<unsigned>&);
+
+    struct item_t {
+        uint64_t weight;
+        int symbol; // -1 for a package
+    };
+
+    std::vector<unsigned> order_;
+    std::vector<std::vector<item_t>> levels_;
+};
+
+// Return the code lengths of an optimal prefix code for symbols with the
+// given weights, where no code is longer than max_length. Every symbol gets
+// a code, including those of weight zero.
+// Throws a runtime_error if max_length is too short to give every symbol
+// its own code.
+std::vector<unsigned> package_merge(const std::vector<uint64_t>& weights,
+                                    unsigned max_length);
+
+// The same, working in scratch and leaving the lengths in lengths.
+void package_merge(const std::vector<uint64_t>& weights, unsigned max_length,
+                   PackageMergeScratch& scratch, std::vector<unsigned>& lengths);
+
+} // namespace
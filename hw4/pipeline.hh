@@ -0,0 +1,170 @@
+/*
+ * pipeline.hh: a three-stage reader/coder/writer pipeline. The reader and
+ * the writer each get a thread of their own, and talk to the coder (on the
+ * calling thread) through bounded single-producer/single-consumer rings, so
+ * even a strictly sequential coder never waits on I/O as long as the I/O
+ * keeps up.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace huffman {
+
+// A bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Each side only ever writes its own index, so a push or
+// pop is a couple of atomic loads and one atomic store.
+template <typename T>
+class SpscRing {
+  public:
+    // Room for `capacity` values (at least one).
+    explicit SpscRing(size_t capacity)
+        : slots_(std::max<size_t>(capacity, 1) + 1)
+    { }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer: add value, waiting while the ring is full. Returns false
+    // (dropping value) if the consumer has given up.
+    bool push(T value) {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        const auto next = (tail + 1) % slots_.size();
+        for (unsigned spins = 0; next == head_.load(std::memory_order_acquire); ) {
+            if (cancelled_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            backoff(spins);
+        }
+        slots_[tail] = std::move(value);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Producer: there are no more values.
+    void close() { closed_.store(true, std::memory_order_release); }
+
+    // Consumer: take the oldest value, waiting while the ring is empty.
+    // Returns false once the producer has closed the ring and every value
+    // has been taken, or once either side has cancelled.
+    bool pop(T& value) {
+        const auto head = head_.load(std::memory_order_relaxed);
+        for (unsigned spins = 0; head == tail_.load(std::memory_order_acquire); ) {
+            /* Values pushed before close() are still there to take. */
+            if (closed_.load(std::memory_order_acquire)) {
+                if (head == tail_.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                break;
+            }
+            if (cancelled_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            backoff(spins);
+        }
+        value = std::move(slots_[head]);
+        head_.store((head + 1) % slots_.size(), std::memory_order_release);
+        return true;
+    }
+
+    // Either side: stop the transfer. The producer's pushes fail and the
+    // consumer's pops end.
+    void cancel() { cancelled_.store(true, std::memory_order_release); }
+
+  private:
+    std::vector<T> slots_;  // One always stays empty, to tell full from empty
+    alignas(64) std::atomic<size_t> head_{ 0 };  // Next slot to pop
+    alignas(64) std::atomic<size_t> tail_{ 0 };  // Next slot to push
+    std::atomic<bool> closed_{ false };
+    std::atomic<bool> cancelled_{ false };
+
+    // Wait a little for the other side: yield at first, then (if it's
+    // blocked on I/O, say) sleep rather than burn a core.
+    static void backoff(unsigned& spins) {
+        if (++spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+};
+
+// Run read() on a reader thread until it returns false, code() on each value
+// it read (in order) on this thread, and write() on each value code()
+// produced (in order) on a writer thread, with up to `depth` values waiting
+// between each pair of stages. Then run finish(), which may produce one last
+// value for the writer.
+//
+// read(In&) fills in the next input and returns whether there was one;
+// code(In&, Out&) turns it into output; finish(Out&) produces the last
+// output; write(Out&) writes an output out.
+//
+// An exception thrown by any stage stops the others and is rethrown here.
+template <typename In, typename Out, typename Read, typename Code,
+          typename Finish, typename Write>
+void run_pipeline(Read read, Code code, Finish finish, Write write, size_t depth = 4) {
+    SpscRing<In> inputs(depth);
+    SpscRing<Out> outputs(depth);
+    std::exception_ptr read_error, write_error;
+
+    std::thread reader([&]() {
+        try {
+            for (In input{}; read(input) && inputs.push(std::move(input)); ) {
+                input = In();
+            }
+        } catch (...) {
+            read_error = std::current_exception();
+            inputs.cancel();
+        }
+        inputs.close();
+    });
+    std::thread writer([&]() {
+        try {
+            for (Out output{}; outputs.pop(output); ) {
+                write(output);
+            }
+        } catch (...) {
+            write_error = std::current_exception();
+            outputs.cancel();
+        }
+    });
+
+    std::exception_ptr code_error;
+    try {
+        for (In input{}; inputs.pop(input); ) {
+            Out output{};
+            code(input, output);
+            if (!outputs.push(std::move(output))) {
+                break;  // The writer has failed
+            }
+        }
+        if (!read_error) {
+            Out output{};
+            finish(output);
+            outputs.push(std::move(output));
+        }
+    } catch (...) {
+        code_error = std::current_exception();
+        outputs.cancel();
+    }
+    inputs.cancel();  // In case the reader is still waiting to push
+    outputs.close();
+    reader.join();
+    writer.join();
+
+    for (const auto& error : { read_error, code_error, write_error }) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+} // namespace
@@ -3,6 +3,10 @@
  * by Miles Baker
  */
 
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
 #include "ptrtree.hh"
 
 namespace tree {
@@ -11,16 +15,15 @@ namespace tree {
         value_ = value;
         left_ = nullptr;
         right_ = nullptr;
+        parent_ = nullptr;
         size_ = 1;
+        owner_ = false;
     }
 
-    PtrTree::PtrTree(value_t newroot, const PtrTree& left, const PtrTree& right) {
-        value_ = newroot;
-        left_ = &left;
-        right_ = &right;
-        size_ = 1;
-        size_ += left_->size_;
-        size_ += right_->size_;
+    PtrTree::PtrTree(value_t newroot, const PtrTree& left, const PtrTree& right)
+        : PtrTree(newroot, &left, &right)
+    {
+        owner_ = false;
     }
 
     PtrTree::PtrTree(value_t newroot, const PtrTree* const left,
@@ -28,18 +31,37 @@ namespace tree {
         value_ = newroot;
         left_ = left;
         right_ = right;
+        parent_ = nullptr;
         size_ = 1;
-        if (left_ != nullptr) {
-            size_ += left_->size_;
-        }
-        if (right_ != nullptr) {
-            size_ += right_->size_;
+        owner_ = true;
+        for (auto child : { left_, right_ }) {
+            if (child != nullptr && child->parent_ != nullptr) {
+                throw std::runtime_error("subtree is already in another tree!");
+            }
         }
+        adopt(left_);
+        adopt(right_);
     }
 
     PtrTree::~PtrTree() {
-        delete left_;
-        delete right_;
+        if (owner_) {
+            delete left_;
+            delete right_;
+            return;
+        }
+        /* Borrowed children outlive us, and are free to join another tree. */
+        for (auto child : { left_, right_ }) {
+            if (child != nullptr && child->parent_ == this) {
+                child->parent_ = nullptr;
+            }
+        }
+    }
+
+    void PtrTree::adopt(const PtrTree* child) {
+        if (child != nullptr) {
+            child->parent_ = this;
+            size_ += child->size_;
+        }
     }
 
     unsigned PtrTree::size() const {
@@ -47,66 +69,108 @@ namespace tree {
     }
 
     std::string PtrTree::pathTo(value_t value) const {
-        std::string result = getPathTo(value);
-        if (result == "no") {
+        std::call_once(indexed_, [this]() { buildIndex(); });
+        const auto found = index_->find(value);
+        if (found == index_->end()) {
             throw std::runtime_error("value not found in tree!");
-        } else {
-            return result;
         }
-    }
-
-    std::string PtrTree::getPathTo(value_t value) const {
-        if (value_ == value) {
-            return "";
-        } else {
-            // look in the children for the value, if they exist
-            std::string left_path = "no", right_path = "no";
 
-            if (left_ != nullptr) {
-                left_path = left_->getPathTo(value);
-                if (left_path != "no") {
-                    left_path.insert(left_path.begin(), 'L');
-                }
-            }
+        /* Climb from the value's node back up to this root, noting which
+         * side of its parent each node hangs on, then flip the turns
+         * around. */
+        std::string path;
+        for (auto node = found->second; node != this; node = node->parent_) {
+            path.push_back(node->parent_->left_ == node ? 'L' : 'R');
+        }
+        std::reverse(path.begin(), path.end());
+        return path;
+    }
 
-            if (right_ != nullptr) {
-                right_path = right_->getPathTo(value);
-                if (right_path != "no") {
-                    right_path.insert(right_path.begin(), 'R');
-                }
+    void PtrTree::buildIndex() const {
+        /* Visit the nodes in preorder (the root, then all of the left
+         * subtree before the right), keeping the first node seen for each
+         * value: that gives duplicates the same left bias as a search. */
+        index_.reset(new Index);
+        std::vector<const PtrTree*> pending{ this };
+        while (!pending.empty()) {
+            const auto node = pending.back();
+            pending.pop_back();
+            index_->emplace(node->value_, node);
+            if (node->right_ != nullptr) {
+                pending.push_back(node->right_);
             }
-
-            if (left_path != "no") {
-                // we have a bias to the left, here, if there are two
-                // duplicate values in the tree
-                return left_path;
-            } else if (right_path != "no") {
-                return right_path;
-            } else {
-                return std::string("no");
+            if (node->left_ != nullptr) {
+                pending.push_back(node->left_);
             }
         }
     }
 
     PtrTree::value_t PtrTree::getByPath(const std::string& path) const {
-        if (path.length() == 0) {
-            return value_;
-        }
-        char direction = path[0];
-        if (direction == 'L') {
-            if (left_ != nullptr) {
-                return left_->getByPath(path.substr(1));
-            } else {
-                throw std::runtime_error("Value not in tree!");
+        auto node = cursor();
+        for (auto direction : path) {
+            if (direction != 'L' && direction != 'R') {
+                throw std::runtime_error("invalid character in path!");
             }
-        } else if (direction == 'R') {
-            if (right_ != nullptr) {
-                return right_->getByPath(path.substr(1));
-            } else {
+            if (!node.descend(direction == 'R')) {
                 throw std::runtime_error("Value not in tree!");
             }
-        } else {
-            throw std::runtime_error("invalid character in path!");
+        }
+        return node.value();
+    }
+
+    /* A cursor names a node by its address. */
+    uintptr_t PtrTree::root() const {
+        return reinterpret_cast<uintptr_t>(this);
+    }
+
+    bool PtrTree::child(uintptr_t& node, bool right) const {
+        const auto tree = reinterpret_cast<const PtrTree*>(node);
+        const auto next = right ? tree->right_ : tree->left_;
+        if (next == nullptr) {
+            return false;
+        }
+        node = reinterpret_cast<uintptr_t>(next);
+        return true;
+    }
+
+    PtrTree::value_t PtrTree::value(uintptr_t node) const {
+        return reinterpret_cast<const PtrTree*>(node)->value_;
+    }
+
+    NodePool::NodePool(size_t capacity)
+        : capacity_(capacity)
+    { }
+
+    NodePool::~NodePool() {
+        clear();
+    }
+
+    void* NodePool::slot() {
+        if (used_ == capacity_) {
+            throw std::runtime_error("node pool is full!");
+        }
+        if (!slots_) {
+            slots_.reset(new slot_t[capacity_]);
+        }
+        return &slots_[used_];
+    }
+
+    PtrTree* NodePool::leaf(value_t value) {
+        const auto node = new (slot()) PtrTree(value);
+        used_++;
+        return node;
+    }
+
+    PtrTree* NodePool::join(value_t newroot, const PtrTree& left, const PtrTree& right) {
+        const auto node = new (slot()) PtrTree(newroot, left, right);
+        used_++;
+        return node;
+    }
+
+    void NodePool::clear() {
+        /* No node owns another, so any order will do. */
+        while (used_) {
+            reinterpret_cast<PtrTree*>(&slots_[--used_])->~PtrTree();
         }
     }
 
@@ -1,36 +1,106 @@
 
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "tree.hh"
 
 namespace tree {
 
+// A tree can be joined into at most one other tree at a time: a node knows
+// its parent, so that pathTo() can climb from a value's node up to the root.
 class PtrTree : public Tree {
   public:
     PtrTree(value_t value);
     ~PtrTree();
+    // Borrows both children, which must outlive the new tree.
+    // Throws a runtime_error if either child is already in another tree.
     PtrTree(value_t newroot, const PtrTree& left, const PtrTree& right);
+    // Takes ownership of both children (either may be null).
+    // Throws a runtime_error (leaving the children to the caller) if either
+    // child is already in another tree.
     PtrTree(value_t newroot, const PtrTree* const left, const PtrTree* const right);
 
     virtual unsigned size() const override;
 
+    // The first call indexes the whole tree (safely, even from several
+    // threads at once); later calls take time in proportion to the path.
     virtual std::string pathTo(value_t value) const override;
 
     value_t getByPath(const std::string& path) const override;
 
     void print(int depth) const;
 
+  protected:
+    virtual uintptr_t root() const override;
+    virtual bool child(uintptr_t& node, bool right) const override;
+    virtual value_t value(uintptr_t node) const override;
+
   private:
     value_t value_;
     const PtrTree *left_;
     const PtrTree *right_;
+    // The tree this one was joined into, if any. Set by the parent's
+    // constructor, hence mutable.
+    mutable const PtrTree *parent_;
     unsigned int size_;
+    bool owner_;  // Does this tree delete its children?
+
+    // Where each value is in this tree (the first in preorder, for
+    // duplicates), built by the first pathTo() on it. Only trees that get
+    // asked for paths have one.
+    using Index = std::unordered_map<value_t, const PtrTree*>;
+    mutable std::unique_ptr<Index> index_;
+    mutable std::once_flag indexed_;
+
+    void adopt(const PtrTree* child);
+    void buildIndex() const;
+};
+
+// Room for the nodes of a PtrTree of up to `capacity` nodes, kept from one
+// tree to the next: clear() destroys every node built so far but keeps the
+// memory, so building the next tree doesn't allocate. (The memory is only
+// allocated with the first node.) Joined nodes borrow their children, which
+// the pool destroys itself.
+class NodePool {
+  public:
+    using value_t = PtrTree::value_t;
+
+    explicit NodePool(size_t capacity);
+    ~NodePool();
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    // Build a new node in the pool.
+    // Throws a runtime_error if the pool is full.
+    PtrTree* leaf(value_t value);
+    PtrTree* join(value_t newroot, const PtrTree& left, const PtrTree& right);
+
+    // Destroy every node in the pool.
+    void clear();
+
+    size_t capacity() const { return capacity_; }
+
+    // Heap memory held by the pool, in bytes (not counting the index that
+    // pathTo() builds in a tree it's asked about).
+    size_t memoryUsage() const { return slots_ ? capacity_ * sizeof(slot_t) : 0; }
+
+  private:
+    using slot_t = std::aligned_storage<sizeof(PtrTree), alignof(PtrTree)>::type;
+
+    std::unique_ptr<slot_t[]> slots_;
+    size_t capacity_;
+    size_t used_ = 0;
 
-    std::string getPathTo(value_t value) const;
+    void* slot();  // The next free slot
 };
 
 } // namespace
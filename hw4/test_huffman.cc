@@ -1,10 +1,23 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
+#include "asyncio.hh"
+#include "bitio.hh"
+#include "block.hh"
+#include "codebook.hh"
+#include "decoder.hh"
+#include "frame.hh"
+#include "header.hh"
+#include "packagemerge.hh"
+#include "pipeline.hh"
 #include "huffman.hh"
+#include "workers.hh"
 
 #include <limits.h>
 #include <cstdlib>
+#include <cstdio>
 #include <ctime>
+#include <queue>
+#include <unistd.h>
 
 using namespace huffman;
 
@@ -173,3 +186,880 @@ TEST_CASE("Handling 0-byte correctly", "[null-terminator]") {
     }
     REQUIRE(vec == dec);
 }
+
+// Encode str with a model configured by config, and decode it back
+std::string roundtrip(const std::string& str, const Huffman::config_t& config) {
+    auto huff = Huffman(config);
+    auto huff2 = Huffman(config);
+    Huffman::encoding_t enc;
+    for (auto c : str) {
+        for (auto bit : huff.encode(c)) {
+            enc.push_back(bit);
+        }
+        huff.incFreq(c);
+    }
+    for (auto bit : huff.eofCode()) {
+        enc.push_back(bit);
+    }
+
+    auto b = enc.cbegin();
+    auto e = enc.cend();
+    std::string dec;
+    while (b != e) {
+        const auto symbol = huff2.decode(b, e);
+        if (!symbol && b == e) {
+            break;
+        }
+        dec.push_back(symbol);
+        huff2.incFreq(symbol);
+    }
+    return dec;
+}
+
+TEST_CASE("Rebuild modes decode to the same thing", "[rebuild]") {
+    const std::string str = "she sells sea shells by the sea shore";
+    REQUIRE(roundtrip(str, { Huffman::update_t::REBUILD, 1 }) == str);
+    REQUIRE(roundtrip(str, { Huffman::update_t::REBUILD, 7 }) == str);
+    REQUIRE(roundtrip(str, { Huffman::update_t::REBUILD, 1000 }) == str);
+    REQUIRE(roundtrip(str, { Huffman::update_t::GEOMETRIC, 8 }) == str);
+}
+
+TEST_CASE("Periodic rebuilds only change the code on schedule", "[rebuild]") {
+    auto huff = Huffman({ Huffman::update_t::REBUILD, 4 });
+    const auto before = huff.encode('a');
+    for (unsigned i = 0; i < 3; ++i) {
+        huff.incFreq('a');
+        REQUIRE(huff.encode('a') == before);
+    }
+    huff.incFreq('a');
+    REQUIRE(huff.encode('a').size() == 1);
+}
+
+TEST_CASE("Array and pointer trees give the same code", "[arraytree]") {
+    Huffman::config_t pointer, array;
+    pointer.update = array.update = Huffman::update_t::REBUILD;
+    array.tree = Huffman::tree_t::ARRAY;
+    auto huff = Huffman(pointer);
+    auto huff2 = Huffman(array);
+    for (auto c : std::string("mississippi")) {
+        for (unsigned i = 0; i < 256; ++i) {
+            REQUIRE(huff.encode(i) == huff2.encode(i));
+        }
+        REQUIRE(huff.eofCode() == huff2.eofCode());
+        huff.incFreq(c);
+        huff2.incFreq(c);
+    }
+}
+
+TEST_CASE("Canonical codes follow length and value order", "[codebook]") {
+    CodeBook book;
+    book.assign({ 2, 1, 3, 0, 3 });
+    // Codes are stored first bit first, starting from the LSB:
+    REQUIRE(book.code(1).length == 1);
+    REQUIRE(book.code(1).bits == 0b0);   // 0
+    REQUIRE(book.code(0).length == 2);
+    REQUIRE(book.code(0).bits == 0b01);  // 10
+    REQUIRE(book.code(2).bits == 0b011); // 110
+    REQUIRE(book.code(4).bits == 0b111); // 111
+    REQUIRE(book.code(3).length == 0);
+
+    CodeBook::value_t value;
+    REQUIRE(book.lookup(2, 0b10, value));
+    REQUIRE(value == 0);
+    REQUIRE(book.lookup(3, 0b111, value));
+    REQUIRE(value == 4);
+    REQUIRE(!book.lookup(2, 0b11, value));
+
+    REQUIRE_THROWS_AS(book.assign({ 1, 1, 1 }), std::runtime_error);
+}
+
+TEST_CASE("Decode table resolves short codes in one lookup", "[codebook]") {
+    // Value 3 is longer than the table, so its slots are left empty.
+    std::vector<unsigned> lengths = { 1, 2, 3, CodeBook::TABLE_BITS + 1, CodeBook::TABLE_BITS + 1 };
+    CodeBook book;
+    book.assign(lengths);
+    for (uint32_t window = 0; window < (1u << CodeBook::TABLE_BITS); ++window) {
+        const auto& entry = book.peek(window);
+        if (entry.length == 0) {
+            REQUIRE((window & 0b111) == 0b111);
+            continue;
+        }
+        const auto& code = book.code(entry.value);
+        REQUIRE(entry.length == code.length);
+        REQUIRE((window & ((1u << code.length) - 1)) == code.bits);
+    }
+}
+
+TEST_CASE("Long codes decode through the slow path", "[codebook]") {
+    /* Feed a geometric distribution so some symbols get codes longer than
+     * the decode table. */
+    std::string str;
+    for (unsigned i = 0; i < 16; ++i) {
+        str += std::string(1u << (15 - i), 'a' + i);
+    }
+    REQUIRE(roundtrip(str, { Huffman::update_t::REBUILD, 4096 }) == str);
+}
+
+TEST_CASE("Rebuilt codes keep the tree's code lengths", "[codebook]") {
+    auto huff = Huffman({ Huffman::update_t::REBUILD, 1 });
+    for (auto c : std::string("abracadabra")) {
+        huff.incFreq(c);
+    }
+    REQUIRE(huff.encode('a').size() == 1);
+    REQUIRE(huff.encode('b').size() <= huff.encode('c').size());
+    REQUIRE(huff.encode('r').size() < huff.encode('z').size());
+}
+
+TEST_CASE("Package-merge limits code lengths optimally", "[package-merge]") {
+    // Unconstrained, the Huffman lengths would be 1, 2, 3, 3.
+    REQUIRE(package_merge({ 4, 2, 1, 1 }, 3) == std::vector<unsigned>({ 1, 2, 3, 3 }));
+    REQUIRE(package_merge({ 4, 2, 1, 1 }, 2) == std::vector<unsigned>({ 2, 2, 2, 2 }));
+    REQUIRE_THROWS_AS(package_merge({ 1, 1, 1, 1, 1 }, 2), std::runtime_error);
+
+    // Fibonacci weights give the deepest possible Huffman tree.
+    std::vector<uint64_t> fib = { 1, 1 };
+    while (fib.size() < 30) {
+        fib.push_back(fib[fib.size() - 1] + fib[fib.size() - 2]);
+    }
+    const auto lengths = package_merge(fib, 12);
+    double kraft = 0;
+    for (auto length : lengths) {
+        REQUIRE(length >= 1);
+        REQUIRE(length <= 12);
+        kraft += 1.0 / (1u << length);
+    }
+    REQUIRE(kraft == 1.0);
+
+    // Scratch space can be reused across limits.
+    PackageMergeScratch scratch;
+    std::vector<unsigned> reused;
+    for (unsigned limit : { 12, 20, 5, 12 }) {
+        package_merge(fib, limit, scratch, reused);
+        REQUIRE(reused == package_merge(fib, limit));
+    }
+}
+
+TEST_CASE("Length-limited models never exceed the limit", "[package-merge]") {
+    std::string str;
+    for (unsigned i = 0; i < 16; ++i) {
+        str += std::string(1u << (15 - i), 'a' + i);
+    }
+    Huffman::config_t config;
+    config.update = Huffman::update_t::REBUILD;
+    config.interval = 4096;
+    config.max_length = Huffman::MIN_LENGTH;
+    REQUIRE(roundtrip(str, config) == str);
+
+    auto huff = Huffman(config);
+    for (auto c : str) {
+        huff.incFreq(c);
+    }
+    for (unsigned i = 0; i < 256; ++i) {
+        REQUIRE(huff.encode(i).size() <= Huffman::MIN_LENGTH);
+    }
+    REQUIRE(huff.eofCode().size() <= Huffman::MIN_LENGTH);
+}
+
+TEST_CASE("Static codes only change when rebuilt", "[static]") {
+    Huffman::config_t config;
+    config.update = Huffman::update_t::STATIC;
+    auto huff = Huffman(config);
+    const std::string str = "static codes are built once, from the whole input";
+    const auto before = huff.encode('s');
+    for (auto c : str) {
+        huff.incFreq(c);
+        REQUIRE(huff.encode('s') == before);
+    }
+    huff.rebuild();
+    REQUIRE(huff.encode(' ').size() < before.size());
+
+    // A decoder only needs the code lengths:
+    Huffman::encoding_t header;
+    write_lengths(header, huff.codeLengths());
+    auto b = header.cbegin();
+    auto huff2 = Huffman(config);
+    huff2.setCodeLengths(read_lengths(b, header.cend(), Huffman::NUM_VALUES));
+    REQUIRE(b == header.cend());
+    for (unsigned i = 0; i < 256; ++i) {
+        REQUIRE(huff.encode(i) == huff2.encode(i));
+    }
+    REQUIRE(huff.eofCode() == huff2.eofCode());
+
+    REQUIRE_THROWS_AS(Huffman().codeLengths(), std::runtime_error);
+    REQUIRE_THROWS_AS(huff2.setCodeLengths({ 1, 1 }), std::runtime_error);
+}
+
+// Code a block on its own, as bytes.
+static std::vector<char> block_bytes(const std::string& str, const Huffman::config_t& config,
+                                     unsigned streams = 1) {
+    BitWriter writer;
+    encode_block(reinterpret_cast<const Huffman::symbol_t*>(str.data()), str.size(),
+                 config, writer, streams);
+    return writer.finish();
+}
+
+TEST_CASE("Blocks decode independently of each other", "[blocks]") {
+    const std::string first = "aaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbcccc";
+    const std::string second("\x01\x02\x03\n\n\n\0zzzzzzzz", 15);
+    Huffman::config_t config;
+    config.max_length = 12;
+
+    auto bytes = block_bytes(first, config);
+    const auto block2 = block_bytes(second, config);
+    bytes.insert(bytes.end(), block2.begin(), block2.end());
+    const auto end_marker = block_bytes("", config);
+    bytes.insert(bytes.end(), end_marker.begin(), end_marker.end());
+
+    BitReader in(bytes.data(), bytes.data() + bytes.size());
+    std::string out;
+    REQUIRE(decode_block(in, out) == first.size());
+    REQUIRE(out == first);
+    REQUIRE(decode_block(in, out) == second.size());
+    REQUIRE(out == first + second);
+    REQUIRE(decode_block(in, out) == 0);
+    REQUIRE(in.bitsLeft() == 0);
+
+    // The second block also decodes on its own:
+    BitReader in2(block2.data(), block2.data() + block2.size());
+    std::string out2;
+    REQUIRE(decode_block(in2, out2) == second.size());
+    REQUIRE(out2 == second);
+
+    // But not if it's cut short:
+    BitReader cut(block2.data(), block2.data() + block2.size() - 1);
+    REQUIRE_THROWS_AS(decode_block(cut, out2), std::runtime_error);
+
+    // Nor if its count is more than the input could hold:
+    auto inflated = block2;
+    std::fill(inflated.begin(), inflated.begin() + 4, '\xFF');
+    BitReader big(inflated.data(), inflated.data() + inflated.size());
+    REQUIRE_THROWS_AS(decode_block(big, out2), std::runtime_error);
+}
+
+TEST_CASE("Interleaved streams decode to the same thing", "[blocks]") {
+    std::string str;
+    for (unsigned i = 0; i < 1000; i++) {
+        str += char('a' + (i * i) % 7);
+    }
+
+    for (unsigned streams : { 1u, 2u, 4u, 5u, MAX_STREAMS }) {
+        for (size_t count : { size_t(1), size_t(3), size_t(16), str.size() }) {
+            const auto bytes = block_bytes(str.substr(0, count), Huffman::config_t(), streams);
+            BitReader in(bytes.data(), bytes.data() + bytes.size());
+            std::string out;
+            REQUIRE(decode_block(in, out, streams) == count);
+            REQUIRE(out == str.substr(0, count));
+            REQUIRE(in.bitsLeft() == 0);
+        }
+    }
+
+    // The number of streams is part of a block stream's header:
+    Huffman::config_t config;
+    block_config_t layout{ true, 4 };
+    Huffman::encoding_t bits;
+    write_header(bits, config, layout);
+    auto b = bits.cbegin();
+    block_config_t found;
+    read_header(b, bits.cend(), &found);
+    REQUIRE(found.blocks);
+    REQUIRE(found.streams == 4);
+    layout.streams = MAX_STREAMS + 1;
+    REQUIRE_THROWS_AS(write_header(bits, config, layout), std::runtime_error);
+}
+
+TEST_CASE("Block indexes find every block", "[blocks]") {
+    const std::string first(1000, 'a');
+    const std::string second = "hello, world\n";
+    Huffman::config_t config;
+
+    BitWriter writer;
+    Huffman::encoding_t header;
+    write_header(header, config, block_config_t{ true });
+    writer.write(header);
+    block_index_t index;
+    for (const auto& str : { first, second }) {
+        index.push_back({ writer.bitCount() / 8, str.size() });
+        encode_block(reinterpret_cast<const Huffman::symbol_t*>(str.data()), str.size(),
+                     config, writer);
+    }
+    encode_block(nullptr, 0, config, writer);
+    Huffman::encoding_t trailer;
+    write_block_index(trailer, index, writer.bitCount() / 8);
+    writer.write(trailer);
+    auto bytes = writer.finish();
+
+    block_index_t found;
+    REQUIRE(read_block_index(bytes.data(), bytes.data() + bytes.size(), found));
+    REQUIRE(found.size() == 2);
+    for (unsigned i = 0; i < 2; i++) {
+        REQUIRE(found[i].offset == index[i].offset);
+        REQUIRE(found[i].count == index[i].count);
+    }
+
+    // The second block decodes straight from its offset:
+    BitReader in(bytes.data(), found[1].offset * 8, bytes.size() * 8);
+    std::string out;
+    REQUIRE(decode_block(in, out) == second.size());
+    REQUIRE(out == second);
+
+    // Streams that don't end with an index are told apart:
+    bytes.pop_back();
+    REQUIRE(!read_block_index(bytes.data(), bytes.data() + bytes.size(), found));
+    REQUIRE(found.empty());
+    const auto end_marker = block_bytes("", config);
+    REQUIRE(!read_block_index(end_marker.data(), end_marker.data() + end_marker.size(),
+                              found));
+}
+
+TEST_CASE("Bit writers and readers agree on every width", "[bitio]") {
+    BitWriter writer;
+    Huffman::encoding_t expected;
+    uint64_t bits = 0x9e3779b97f4a7c15;
+    for (unsigned length = 0; length <= 64; length++) {
+        bits = bits * 6364136223846793005 + 1442695040888963407;
+        writer.write(bits, length);
+        for (unsigned i = 0; i < length; i++) {
+            expected.push_back(Huffman::bit_t((bits >> i) & 1));
+        }
+    }
+    writer.write({ Huffman::ONE, Huffman::ZERO, Huffman::ONE });
+    expected.insert(expected.end(), { Huffman::ONE, Huffman::ZERO, Huffman::ONE });
+    REQUIRE(writer.bitCount() == expected.size());
+
+    const auto bytes = writer.finish();
+    REQUIRE(bytes.size() == (expected.size() + 7) / 8);
+    REQUIRE(writer.bitCount() == 0);
+    for (size_t i = 0; i < expected.size(); i++) {
+        REQUIRE(((bytes[i / 8] >> (i % 8)) & 1) == expected[i]);
+    }
+
+    // Read it back in uneven pieces:
+    BitReader reader(bytes.data(), bytes.data() + bytes.size());
+    size_t pos = 0;
+    for (unsigned count = 1; pos < expected.size(); count = count % BitReader::MAX_PEEK + 1) {
+        count = std::min<unsigned>(count, expected.size() - pos);
+        const auto word = reader.read(count);
+        for (unsigned i = 0; i < count; i++) {
+            REQUIRE(((word >> i) & 1) == expected[pos++]);
+        }
+    }
+    reader.alignToByte();
+    REQUIRE(reader.bitsLeft() == 0);
+    REQUIRE(reader.peek(8) == 0);
+    REQUIRE_THROWS_AS(reader.read(1), std::runtime_error);
+}
+
+TEST_CASE("Draining a bit writer keeps the stream intact", "[bitio]") {
+    BitWriter whole, drained;
+    std::vector<char> bytes, part;
+    for (unsigned i = 0; i < 1000; i++) {
+        whole.write(i * 2654435761u, i % 23);
+        drained.write(i * 2654435761u, i % 23);
+        if (i % 100 == 99) {
+            drained.drain(part);
+            REQUIRE(part.size() % 8 == 0);
+            bytes.insert(bytes.end(), part.begin(), part.end());
+        }
+        REQUIRE(drained.bitCount() == whole.bitCount());
+    }
+    part = drained.finish();
+    bytes.insert(bytes.end(), part.begin(), part.end());
+    REQUIRE(bytes == whole.finish());
+}
+
+TEST_CASE("Packed codes match the bit vectors", "[bitio]") {
+    for (auto update : { Huffman::update_t::ADAPTIVE, Huffman::update_t::REBUILD,
+                         Huffman::update_t::STATIC }) {
+        Huffman huff(update);
+        BitWriter writer;
+        Huffman::encoding_t expected;
+        const std::string str("mississippi river \xff\x00 banks", 26);
+        for (auto c : str) {
+            writer.write(Huffman::encoding_t{ Huffman::ONE });
+            expected.push_back(Huffman::ONE);
+            huff.encode(c, writer);
+            const auto code = huff.encode(c);
+            expected.insert(expected.end(), code.begin(), code.end());
+            huff.incFreq(c);
+        }
+        huff.eofCode(writer);
+        const auto eof = huff.eofCode();
+        expected.insert(expected.end(), eof.begin(), eof.end());
+
+        REQUIRE(writer.bitCount() == expected.size());
+        const auto bytes = writer.finish();
+        auto bits = unpack_bits(bytes.data(), bytes.data() + bytes.size());
+        bits.resize(expected.size());
+        REQUIRE(bits == expected);
+    }
+}
+
+TEST_CASE("Packed decoding matches bit vector decoding", "[bitio]") {
+    const std::string str("she sells sea shells \xff\x00\x80 by the sea shore", 41);
+    for (auto update : { Huffman::update_t::ADAPTIVE, Huffman::update_t::GEOMETRIC }) {
+        Huffman encoder(update);
+        BitWriter writer;
+        writer.write(0x5, 3); // Start off a byte boundary
+        for (auto c : str) {
+            encoder.encode(c, writer);
+            encoder.incFreq(c);
+        }
+        encoder.eofCode(writer);
+        const auto end = writer.bitCount();
+        writer.write(0x3, 2);
+        const auto bytes = writer.finish();
+
+        Huffman decoder(update);
+        BitReader in(bytes.data(), 3, end);
+        std::string out;
+        Huffman::symbol_t symbol;
+        while (unsigned length = decoder.decode(in, symbol)) {
+            REQUIRE(length == decoder.encode(symbol).size());
+            out.push_back(symbol);
+            decoder.incFreq(symbol);
+        }
+        REQUIRE(out == str);
+        REQUIRE(in.bitsLeft() == 0);
+
+        // Running out of input mid-code isn't a symbol:
+        Huffman truncated(update);
+        BitReader cut(bytes.data(), 3, 4);
+        REQUIRE(truncated.decode(cut, symbol) == 0);
+        REQUIRE(cut.bitsLeft() == 0);
+    }
+}
+
+// A whole compressed stream for str in its frame, the way bitcompress
+// writes it. Sized streams have the length in their frame header.
+static std::vector<char> stream_bytes(const std::string& str, const Huffman::config_t& config,
+                                      const block_config_t& layout, bool sized,
+                                      size_t block_size = 100) {
+    frame_t frame;
+    frame.blocks = layout.blocks;
+    frame.sized = sized;
+    frame.length = str.size();
+    std::vector<char> bytes;
+    write_frame_header(bytes, frame);
+
+    Huffman::encoding_t header;
+    write_header(header, config, layout);
+    BitWriter writer;
+    writer.write(header);
+    const auto symbols = reinterpret_cast<const Huffman::symbol_t*>(str.data());
+    if (layout.blocks) {
+        block_index_t index;
+        for (size_t i = 0; i < str.size(); i += block_size) {
+            const auto count = std::min(block_size, str.size() - i);
+            index.push_back({ writer.bitCount() / 8, count });
+            encode_block(symbols + i, count, config, writer, layout.streams);
+        }
+        encode_block(nullptr, 0, config, writer);
+        header.clear();
+        write_block_index(header, index, writer.bitCount() / 8);
+        writer.write(header);
+        const auto stream = writer.finish();
+        bytes.insert(bytes.end(), stream.begin(), stream.end());
+        write_frame_end(bytes, str.size());
+        return bytes;
+    }
+
+    Huffman huff(config);
+    if (config.update == Huffman::update_t::STATIC) {
+        for (auto c : str) {
+            huff.incFreq(c);
+        }
+        huff.rebuild();
+        header.clear();
+        write_lengths(header, huff.codeLengths());
+        writer.write(header);
+    }
+    for (auto c : str) {
+        huff.encode(c, writer);
+        huff.incFreq(c);
+    }
+    if (!sized) {
+        huff.eofCode(writer);
+    }
+    const auto stream = writer.finish();
+    bytes.insert(bytes.end(), stream.begin(), stream.end());
+    write_frame_end(bytes, str.size());
+    return bytes;
+}
+
+TEST_CASE("Stream decoders take input in any pieces", "[decoder]") {
+    std::string str;
+    for (unsigned i = 0; i < 3000; i++) {
+        str += char(i % 11 ? 'a' + (i * i) % 13 : i % 256);
+    }
+    std::srand(4);
+
+    Huffman::config_t adaptive;
+    Huffman::config_t geometric{ Huffman::update_t::GEOMETRIC, 64, 12 };
+    Huffman::config_t fixed{ Huffman::update_t::STATIC };
+    const block_config_t single, blocks{ true }, streams{ true, 3 };
+    for (auto test : { std::make_pair(adaptive, single), std::make_pair(geometric, single),
+                       std::make_pair(fixed, single), std::make_pair(fixed, blocks),
+                       std::make_pair(fixed, streams) }) {
+        for (bool sized : { false, true }) {
+            const auto bytes = stream_bytes(str, test.first, test.second, sized);
+            for (size_t piece : { size_t(1), size_t(7), size_t(0) }) {
+                StreamDecoder decoder;
+                std::string out;
+                for (size_t i = 0; i < bytes.size(); ) {
+                    const auto size = std::min(piece ? piece : 1 + std::rand() % 300,
+                                               bytes.size() - i);
+                    REQUIRE(!decoder.done());
+                    decoder.push(bytes.data() + i, size, out);
+                    i += size;
+                    // Nothing is held back once its code is complete:
+                    REQUIRE(str.compare(0, out.size(), out) == 0);
+                }
+                REQUIRE(decoder.done());
+                decoder.finish(out);
+                REQUIRE(out == str);
+            }
+
+            // A stream cut short is an error, even if only its end marker is
+            // missing:
+            for (size_t size : { bytes.size() / 2, bytes.size() - 1 }) {
+                StreamDecoder decoder;
+                std::string out;
+                decoder.push(bytes.data(), size, out);
+                REQUIRE(!decoder.done());
+                REQUIRE_THROWS_AS(decoder.finish(out), std::runtime_error);
+            }
+        }
+    }
+}
+
+TEST_CASE("Frames hold the length and reject other data", "[frame]") {
+    for (bool blocks : { false, true }) {
+        frame_t frame;
+        frame.blocks = blocks;
+        frame.sized = !blocks;
+        frame.length = 0x123456789A;
+        std::vector<char> bytes;
+        write_frame_header(bytes, frame);
+        REQUIRE(bytes.size() == FRAME_HEADER_SIZE);
+        const auto parsed = read_frame_header(bytes.data(), bytes.size());
+        REQUIRE(parsed.blocks == frame.blocks);
+        REQUIRE(parsed.sized == frame.sized);
+        REQUIRE(parsed.length == (frame.sized ? frame.length : 0));
+
+        REQUIRE_THROWS_AS(read_frame_header(bytes.data(), bytes.size() - 1),
+                          std::runtime_error);
+        bytes[4]++;
+        REQUIRE_THROWS_AS(read_frame_header(bytes.data(), bytes.size()), std::runtime_error);
+        bytes[0] = '0';
+        REQUIRE_THROWS_AS(read_frame_header(bytes.data(), bytes.size()), std::runtime_error);
+    }
+
+    std::vector<char> bytes;
+    write_frame_end(bytes, 42);
+    REQUIRE(bytes.size() == FRAME_END_SIZE);
+    REQUIRE(read_frame_end(bytes.data(), bytes.size()) == 42);
+    bytes.back() = 0;
+    REQUIRE_THROWS_AS(read_frame_end(bytes.data(), bytes.size()), std::runtime_error);
+
+    // Newlines and zero bytes in a stream are just data:
+    const std::string str("\n\n\0\n\r\n\x1A\0", 8);
+    const auto stream = stream_bytes(str, Huffman::config_t(), block_config_t(), false);
+    StreamDecoder decoder;
+    std::string out;
+    REQUIRE(decoder.push(stream.data(), stream.size(), out));
+    REQUIRE(out == str);
+}
+
+TEST_CASE("Queued reads and writes keep their order", "[asyncio]") {
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file);
+    const int fd = fileno(file);
+
+    std::string expected;
+    {
+        AsyncWriter writer(fd, 3);
+        for (unsigned i = 0; i < 200; i++) {
+            std::vector<char> bytes((i * 37) % 1000, char('a' + i % 26));
+            expected.append(bytes.begin(), bytes.end());
+            writer.write(std::move(bytes));
+        }
+        writer.write(expected.data(), 10);
+        expected.append(expected.data(), 10);
+        writer.finish();
+    }
+    REQUIRE(uint64_t(lseek(fd, 0, SEEK_CUR)) == expected.size());
+
+    for (size_t chunk_size : { size_t(1000), size_t(4096), expected.size() + 1 }) {
+        lseek(fd, 0, SEEK_SET);
+        AsyncReader reader(fd, chunk_size, 3);
+        std::string read;
+        for (std::string chunk; !(chunk = reader.next()).empty(); ) {
+            REQUIRE((chunk.size() == chunk_size || read.size() + chunk.size() == expected.size()));
+            read += chunk;
+        }
+        REQUIRE(read == expected);
+        REQUIRE(reader.next().empty());
+    }
+    std::fclose(file);
+
+    // Pipes have no offsets, so they're read and written in order directly:
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    {
+        AsyncWriter writer(fds[1]);
+        REQUIRE(!writer.queued());
+        writer.write(std::vector<char>(expected.begin(), expected.begin() + 1000));
+        writer.finish();
+    }
+    close(fds[1]);
+    AsyncReader reader(fds[0], 600);
+    REQUIRE(!reader.queued());
+    REQUIRE(reader.next() == expected.substr(0, 600));
+    REQUIRE(reader.next() == expected.substr(600, 400));
+    REQUIRE(reader.next().empty());
+    close(fds[0]);
+}
+
+TEST_CASE("Pipelines pass every value through in order", "[pipeline]") {
+    for (size_t depth : { 1, 4 }) {
+        int next = 0;
+        std::vector<int> written;
+        run_pipeline<int, std::string>(
+            [&](int& value) { value = next++; return value < 1000; },
+            [](int& value, std::string& out) { out = std::to_string(value); },
+            [](std::string& out) { out = "end"; },
+            [&](std::string& out) {
+                written.push_back(out == "end" ? -1 : std::stoi(out));
+            },
+            depth);
+        REQUIRE(written.size() == 1001);
+        for (int i = 0; i < 1000; i++) {
+            REQUIRE(written[i] == i);
+        }
+        REQUIRE(written.back() == -1);
+    }
+
+    // A failing stage stops the others, and its exception comes through:
+    for (int stage = 0; stage < 3; stage++) {
+        int next = 0;
+        REQUIRE_THROWS_AS((run_pipeline<int, int>(
+            [&](int& value) {
+                if (stage == 0 && next == 500) {
+                    throw std::runtime_error("read");
+                }
+                value = next++;
+                return true;  // Endless, unless something stops it
+            },
+            [&](int& value, int& out) {
+                if (stage == 1 && value == 500) {
+                    throw std::runtime_error("code");
+                }
+                out = value;
+            },
+            [](int&) { },
+            [&](int& out) {
+                if (stage == 2 && out == 500) {
+                    throw std::runtime_error("write");
+                }
+            })), std::runtime_error);
+    }
+}
+
+TEST_CASE("Stream headers round-trip", "[header]") {
+    for (auto config : { Huffman::config_t{ Huffman::update_t::ADAPTIVE, 1 },
+                         Huffman::config_t{ Huffman::update_t::REBUILD, 4096 },
+                         Huffman::config_t{ Huffman::update_t::GEOMETRIC, 65536, 15 },
+                         Huffman::config_t{ Huffman::update_t::STATIC } }) {
+        Huffman::encoding_t bits;
+        write_header(bits, config);
+        auto b = bits.cbegin();
+        const auto parsed = read_header(b, bits.cend());
+        REQUIRE(b == bits.cend());
+
+        bits.clear();
+        write_header(bits, config, block_config_t{ true });
+        REQUIRE(bits.size() % 8 == 0);
+        b = bits.cbegin();
+        REQUIRE_THROWS_AS(read_header(b, bits.cend()), std::runtime_error);
+        block_config_t layout;
+        b = bits.cbegin();
+        read_header(b, bits.cend(), &layout);
+        REQUIRE(layout.blocks);
+        REQUIRE(b == bits.cend());
+        REQUIRE(parsed.update == config.update);
+        if (config.update == Huffman::update_t::REBUILD ||
+                config.update == Huffman::update_t::GEOMETRIC) {
+            REQUIRE(parsed.interval == config.interval);
+            REQUIRE(parsed.max_length == config.max_length);
+        }
+    }
+}
+
+TEST_CASE("Adaptive updates keep the code optimal", "[adaptive]") {
+    /* After every update, the total coded length of the symbols seen so far
+     * must equal that of a Huffman code built from scratch for their counts
+     * (i.e., the sum of the weights of all merged nodes). */
+    srand(1);
+    auto huff = Huffman();
+    std::vector<unsigned long> counts(256, 0);
+    for (unsigned i = 0; i < 2000; ++i) {
+        const Huffman::symbol_t c = (rand() % 7) * (rand() % 37);
+        huff.incFreq(c);
+        counts[c]++;
+
+        std::priority_queue<unsigned long, std::vector<unsigned long>,
+            std::greater<unsigned long>> forest;
+        forest.push(0);  // Not-yet-seen symbols share one zero-weight leaf
+        unsigned long actual = 0, optimal = 0;
+        for (unsigned s = 0; s < 256; ++s) {
+            if (counts[s]) {
+                forest.push(counts[s]);
+                actual += counts[s] * huff.encode(s).size();
+            }
+        }
+        while (forest.size() > 1) {
+            const auto a = forest.top();
+            forest.pop();
+            const auto b = forest.top();
+            forest.pop();
+            optimal += a + b;
+            forest.push(a + b);
+        }
+        REQUIRE(actual == optimal);
+    }
+}
+
+TEST_CASE("Rebuilt codes stay optimal as counts change", "[rebuild]") {
+    /* Rebuilding after every symbol must give a code as short, for the
+     * counts so far (EOF included), as a Huffman code built from scratch. */
+    srand(2);
+    for (auto tree : { Huffman::tree_t::POINTER, Huffman::tree_t::ARRAY }) {
+        Huffman::config_t config;
+        config.update = Huffman::update_t::REBUILD;
+        config.tree = tree;
+        auto huff = Huffman(config);
+        std::vector<unsigned long> counts(Huffman::NUM_VALUES, 0);
+        for (unsigned i = 0; i < 1000; ++i) {
+            const Huffman::symbol_t c = (rand() % 5) * (rand() % 51);
+            huff.incFreq(c);
+            counts[c]++;
+
+            std::priority_queue<unsigned long, std::vector<unsigned long>,
+                std::greater<unsigned long>> forest;
+            unsigned long actual = 0, optimal = 0;
+            for (unsigned s = 0; s < counts.size(); ++s) {
+                forest.push(counts[s]);
+                actual += counts[s] * (s < 256 ? huff.encode(s) : huff.eofCode()).size();
+            }
+            while (forest.size() > 1) {
+                const auto a = forest.top();
+                forest.pop();
+                const auto b = forest.top();
+                forest.pop();
+                optimal += a + b;
+                forest.push(a + b);
+            }
+            REQUIRE(actual == optimal);
+        }
+    }
+}
+
+TEST_CASE("Models take the same memory however long the input", "[memory]") {
+    srand(3);
+    std::string str;
+    for (unsigned i = 0; i < 20000; ++i) {
+        str += static_cast<char>((rand() % 3) * (rand() % 97));
+    }
+    Huffman::config_t limited;
+    limited.update = Huffman::update_t::REBUILD;
+    limited.interval = 64;
+    limited.max_length = Huffman::MIN_LENGTH;
+    Huffman::config_t array;
+    array.update = Huffman::update_t::GEOMETRIC;
+    array.interval = 16;
+    array.tree = Huffman::tree_t::ARRAY;
+    for (auto config : { Huffman::config_t{ Huffman::update_t::ADAPTIVE, 1 },
+                         Huffman::config_t{ Huffman::update_t::REBUILD, 1 },
+                         Huffman::config_t{ Huffman::update_t::STATIC, 1 },
+                         limited, array }) {
+        auto huff = Huffman(config);
+        const auto usage = huff.memoryUsage();
+        REQUIRE(usage > sizeof(huff));
+        for (auto c : str) {
+            huff.incFreq(c);
+            REQUIRE(huff.memoryUsage() == usage);
+        }
+        if (config.update == Huffman::update_t::STATIC) {
+            huff.rebuild();
+            REQUIRE(huff.memoryUsage() == usage);
+        }
+    }
+}
+
+TEST_CASE("Worker pools hand results back in submission order", "[workers]") {
+    WorkerPool workers(4);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 12; ++i) {
+        results.push_back(workers.submit([i]() {
+            // Later jobs finish first.
+            std::this_thread::sleep_for(std::chrono::milliseconds(2 * (12 - i)));
+            if (i == 5) {
+                throw std::runtime_error("job failed");
+            }
+            return i;
+        }));
+    }
+    for (int i = 0; i < 12; ++i) {
+        if (i == 5) {
+            REQUIRE_THROWS_AS(results[i].get(), std::runtime_error);
+        } else {
+            REQUIRE(results[i].get() == i);
+        }
+    }
+}
+
+/* Code str in blocks on a pool of workers with encode_blocks, as bitcompress
+ * -T does. */
+static std::vector<char> pooled_blocks(const std::string& str, const Huffman::config_t& config,
+                                       unsigned streams, unsigned threads, size_t block_size) {
+    WorkerPool workers(threads);
+    std::vector<char> bytes;
+    uint64_t total = 0;
+    size_t pos = 0;
+    encode_blocks(workers, config, streams,
+        [&]() {
+            block_input_t input;
+            input.view = str.data() + pos;
+            input.size = std::min(block_size, str.size() - pos);
+            pos += input.size;
+            return input;
+        },
+        [&](std::vector<char> block, uint64_t count) {
+            total += count;
+            bytes.insert(bytes.end(), block.begin(), block.end());
+        });
+    REQUIRE(total == str.size());
+    return bytes;
+}
+
+TEST_CASE("Blocks coded on several threads match a single thread", "[workers]") {
+    srand(4);
+    std::string str;
+    for (unsigned i = 0; i < 50000; ++i) {
+        str += static_cast<char>((rand() % 4) * (rand() % 64) + (i / 5000));
+    }
+    Huffman::config_t config;
+    config.max_length = 11;
+    const auto single = pooled_blocks(str, config, 3, 1, 1000);
+    for (unsigned threads : { 2, 3, 8 }) {
+        REQUIRE(pooled_blocks(str, config, 3, threads, 1000) == single);
+    }
+
+    // And they're the blocks coded one after another:
+    std::vector<char> serial;
+    for (size_t i = 0; i < str.size(); i += 1000) {
+        const auto block = block_bytes(str.substr(i, 1000), config, 3);
+        serial.insert(serial.end(), block.begin(), block.end());
+    }
+    REQUIRE(single == serial);
+}
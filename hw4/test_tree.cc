@@ -0,0 +1,139 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "arraytree.hh"
+#include "ptrtree.hh"
+
+#include <stdexcept>
+
+using namespace tree;
+
+/*
+ * Both implementations should agree on everything: build the same tree
+ * with each of them and compare.
+ *
+ *          10
+ *        /    \
+ *       20     30
+ *      /  \
+ *     40   50
+ *         /  \
+ *        60   70
+ */
+void check_sample(const Tree& tree) {
+    REQUIRE(tree.size() == 7);
+    REQUIRE(tree.pathTo(10) == "");
+    REQUIRE(tree.pathTo(20) == "L");
+    REQUIRE(tree.pathTo(30) == "R");
+    REQUIRE(tree.pathTo(40) == "LL");
+    REQUIRE(tree.pathTo(50) == "LR");
+    REQUIRE(tree.pathTo(60) == "LRL");
+    REQUIRE(tree.pathTo(70) == "LRR");
+    REQUIRE_THROWS_AS(tree.pathTo(80), std::runtime_error);
+
+    REQUIRE(tree.getByPath("") == 10);
+    REQUIRE(tree.getByPath("LRR") == 70);
+    REQUIRE(tree.getByPath("R") == 30);
+    REQUIRE_THROWS_AS(tree.getByPath("RL"), std::runtime_error);
+    REQUIRE_THROWS_AS(tree.getByPath("LX"), std::runtime_error);
+
+    auto cursor = tree.cursor();
+    REQUIRE(cursor.value() == 10);
+    REQUIRE(!cursor.isLeaf());
+    REQUIRE(cursor.left());
+    REQUIRE(cursor.right());
+    REQUIRE(cursor.value() == 50);
+    REQUIRE(cursor.descend(true));
+    REQUIRE(cursor.value() == 70);
+    REQUIRE(cursor.isLeaf());
+    REQUIRE(!cursor.left());
+    REQUIRE(!cursor.right());
+    REQUIRE(cursor.value() == 70);
+    cursor.reset();
+    REQUIRE(cursor.right());
+    REQUIRE(cursor.value() == 30);
+    REQUIRE(cursor.isLeaf());
+}
+
+TEST_CASE("PtrTree finds values and paths", "[ptrtree]") {
+    /* PtrTree takes ownership of its children. */
+    auto t50 = new PtrTree(50, new PtrTree(60), new PtrTree(70));
+    auto t20 = new PtrTree(20, new PtrTree(40), t50);
+    PtrTree tree(10, t20, new PtrTree(30));
+    check_sample(tree);
+}
+
+TEST_CASE("ArrayTree finds values and paths", "[arraytree]") {
+    /* ArrayTree copies its children instead. */
+    ArrayTree l(40), r(50, ArrayTree(60), ArrayTree(70));
+    ArrayTree t20(20, l, r);
+    ArrayTree tree(10, t20, ArrayTree(30));
+    check_sample(tree);
+}
+
+TEST_CASE("ArrayTree paths are left-biased like PtrTree", "[arraytree]") {
+    ArrayTree tree(1, ArrayTree(2, ArrayTree(3), ArrayTree(4)), ArrayTree(3));
+    REQUIRE(tree.pathTo(3) == "LL");
+}
+
+TEST_CASE("PtrTree paths are left-biased and work from any subtree", "[ptrtree]") {
+    auto left = new PtrTree(2, new PtrTree(3), new PtrTree(4));
+    PtrTree tree(1, left, new PtrTree(3));
+    REQUIRE(tree.pathTo(3) == "LL");
+    REQUIRE(left->pathTo(4) == "R");
+    REQUIRE_THROWS_AS(left->pathTo(1), std::runtime_error);
+
+    /* A long chain down the right side. */
+    auto chain = new PtrTree(0);
+    for (PtrTree::value_t value = 1; value < 300; value++) {
+        chain = new PtrTree(1000 + value, new PtrTree(value), chain);
+    }
+    REQUIRE(chain->pathTo(0) == std::string(299, 'R'));
+    REQUIRE(chain->pathTo(150) == std::string(149, 'R') + "L");
+    delete chain;
+}
+
+TEST_CASE("PtrTree subtrees belong to one tree at a time", "[ptrtree]") {
+    PtrTree a(1), x(2), y(3);
+    {
+        PtrTree b(10, a, x);
+        REQUIRE_THROWS_AS(PtrTree(20, a, y), std::runtime_error);
+        REQUIRE(b.pathTo(1) == "L");
+        REQUIRE(b.pathTo(2) == "R");
+    }
+    /* Once b is gone, a is free to join another tree. */
+    PtrTree c(20, a, y);
+    REQUIRE(c.pathTo(1) == "L");
+    REQUIRE(c.pathTo(3) == "R");
+
+    auto owned = new PtrTree(4);
+    PtrTree d(30, owned, new PtrTree(5));
+    REQUIRE_THROWS_AS(PtrTree(40, owned, nullptr), std::runtime_error);
+    REQUIRE(d.pathTo(4) == "L");
+}
+
+TEST_CASE("NodePool recycles its nodes", "[ptrtree]") {
+    NodePool pool(7);
+    for (int round = 0; round < 3; round++) {
+        auto t50 = pool.join(50, *pool.leaf(60), *pool.leaf(70));
+        auto t20 = pool.join(20, *pool.leaf(40), *t50);
+        check_sample(*pool.join(10, *t20, *pool.leaf(30)));
+        REQUIRE_THROWS_AS(pool.leaf(80), std::runtime_error);
+        pool.clear();
+    }
+}
+
+TEST_CASE("ArrayTreeBuilder lays out trees built from the bottom up", "[arraytree]") {
+    ArrayTreeBuilder builder;
+    ArrayTree tree(0);
+    for (int round = 0; round < 3; round++) {
+        /* Make the nodes in a different order from the layout. */
+        const auto t30 = builder.leaf(30);
+        const auto t50 = builder.join(50, builder.leaf(60), builder.leaf(70));
+        const auto t20 = builder.join(20, builder.leaf(40), t50);
+        builder.build(builder.join(10, t20, t30), tree);
+        check_sample(tree);
+    }
+    builder.build(builder.leaf(5), tree);
+    REQUIRE(tree.size() == 1);
+    REQUIRE(tree.pathTo(5) == "");
+}
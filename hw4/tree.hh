@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace tree {
@@ -45,6 +46,55 @@ class Tree {
     // that path of the tree.
     // Throws a runtime_error exception if the path is invalid in some way.
     virtual value_t getByPath(const std::string& path) const = 0;
+
+    // Walks down a tree one turn at a time, e.g. to decode a code bit by
+    // bit. Moving and reading never allocate. The tree must outlive it.
+    class Cursor {
+      public:
+        // Back to the root.
+        void reset() { node_ = tree_->root(); }
+
+        // Take one turn. Returns false (and stays put) if there's no child
+        // that way.
+        bool descend(bool right) { return tree_->child(node_, right); }
+        bool left() { return descend(false); }
+        bool right() { return descend(true); }
+
+        // Is the cursor on a node without children?
+        bool isLeaf() const {
+            auto node = node_;
+            return !tree_->child(node, false) && !tree_->child(node, true);
+        }
+
+        // The value at the cursor.
+        value_t value() const { return tree_->value(node_); }
+
+      private:
+        friend class Tree;
+        explicit Cursor(const Tree* tree) : tree_(tree), node_(tree->root()) { }
+
+        const Tree* tree_;
+        uintptr_t node_;
+    };
+
+    // A cursor at this tree's root.
+    Cursor cursor() const { return Cursor(this); }
+
+  protected:
+    /*
+     * What a Cursor needs from an implementation: some way to name a node
+     * in a uintptr_t (a pointer, an index...), and steps between them.
+     */
+
+    // The root's node.
+    virtual uintptr_t root() const = 0;
+
+    // Move node to its left or right child and return true, or return false
+    // (leaving node alone) if it has none.
+    virtual bool child(uintptr_t& node, bool right) const = 0;
+
+    // The value at node.
+    virtual value_t value(uintptr_t node) const = 0;
 };
 
 
@@ -0,0 +1,44 @@
+/*
+ * WorkerPool: a minimal thread pool.
+ */
+
+#include <algorithm>
+
+#include "workers.hh"
+
+namespace huffman {
+
+    WorkerPool::WorkerPool(unsigned threads) {
+        for (unsigned i = 0; i < std::max(threads, 1u); i++) {
+            threads_.emplace_back(&WorkerPool::run, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+                if (jobs_.empty()) {
+                    return;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop();
+            }
+            job();
+        }
+    }
+
+} // namespace huffman
@@ -0,0 +1,56 @@
+/*
+ * workers.hh: a fixed pool of worker threads that run queued jobs.
+ * Each job's result comes back through a std::future, so a caller can
+ * hand out work in any order and still collect the results in order.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace huffman {
+
+class WorkerPool {
+  public:
+    // Start `threads` workers (at least one).
+    explicit WorkerPool(unsigned threads);
+    // Finish every queued job, then stop the workers.
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned size() const { return threads_.size(); }
+
+    // Queue job to run on some worker. Exceptions it throws are passed on
+    // through the future.
+    template <typename F>
+    auto submit(F job) -> std::future<decltype(job())> {
+        auto task = std::make_shared<std::packaged_task<decltype(job())()>>(std::move(job));
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push([task]() { (*task)(); });
+        }
+        ready_.notify_one();
+        return result;
+    }
+
+  private:
+    std::vector<std::thread> threads_;
+    std::queue<std::function<void()>> jobs_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stopping_ = false;
+
+    void run();
+};
+
+} // namespace